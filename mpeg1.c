@@ -53,7 +53,24 @@ static int width, height;
 #define MPEG1_TEXTURE_WIDTH 512
 #define MPEG1_TEXTURE_HEIGHT 256
 
-float audio_time;
+/* Number of decoded frames the decode thread may run ahead. */
+#ifndef MPEG1_QUEUE_FRAMES
+#define MPEG1_QUEUE_FRAMES 3
+#endif
+
+/* decode thread and frame queue. The lock also guards the statistics and
+   outlives a playback, so Mpeg1GetStats() can be called at any time. */
+static kthread_t *decode_thread;
+static mutex_t queue_lock = MUTEX_INITIALIZER;
+static condvar_t queue_cond;
+static plm_frame_t *queue[MPEG1_QUEUE_FRAMES];
+static int queue_head, queue_count;
+static int queue_ended;
+static volatile int decode_stop;
+static volatile int late_frames, shown_frames, dropped_frames;
+static float late_time;
+
+volatile float audio_time;
 float audio_interval;
 snd_stream_hnd_t snd_hnd;
 __attribute__((aligned(32))) unsigned int snd_buf[0x10000 / 4];
@@ -213,9 +230,60 @@ void *sound_callback(snd_stream_hnd_t hnd, int size, int *size_out)
     return (void *)snd_buf;
 }
 
+void *decode_thread_func(void *param)
+{
+    plm_frame_t *frame;
+
+    while (!decode_stop)
+    {
+        /* The sound callback decodes audio from the same stream, so it is
+           polled here rather than on the presentation thread. */
+        snd_stream_poll(snd_hnd);
+
+        mutex_lock(&queue_lock);
+        if (queue_ended || queue_count == MPEG1_QUEUE_FRAMES)
+        {
+            cond_wait_timed(&queue_cond, &queue_lock, 10);
+            mutex_unlock(&queue_lock);
+            continue;
+        }
+        mutex_unlock(&queue_lock);
+
+        /* B-pictures that would be late anyway are skipped by the decoder
+           before their slices are decoded. */
+        plm_set_video_deadline(plm, audio_time - audio_interval, late_time);
+        frame = plm_decode_video(plm);
+
+        mutex_lock(&queue_lock);
+        dropped_frames = plm_get_video_dropped_frames(plm, 0);
+        if (frame)
+        {
+            queue[(queue_head + queue_count) % MPEG1_QUEUE_FRAMES] = frame;
+            queue_count++;
+        }
+        else
+            queue_ended = 1;
+        mutex_unlock(&queue_lock);
+    }
+
+    return NULL;
+}
+
+void Mpeg1GetStats(Mpeg1Stats *stats)
+{
+    mutex_lock(&queue_lock);
+    stats->queue_depth = queue_count;
+    stats->late_frames = late_frames;
+    stats->shown_frames = shown_frames;
+    stats->dropped_frames = dropped_frames;
+    mutex_unlock(&queue_lock);
+}
+
 int Mpeg1Play(const char *filename, unsigned int buttons)
 {
     int cancel = 0;
+    plm_frame_t *frame;
+    float audio_clock;
 
     plm = plm_create_with_filename(filename);
     if (!plm)
@@ -223,6 +291,7 @@ int Mpeg1Play(const char *filename, unsigned int buttons)
     texture = pvr_mem_malloc(MPEG1_TEXTURE_WIDTH * MPEG1_TEXTURE_HEIGHT * 2);
     width = plm_get_width(plm);
     height = plm_get_height(plm);
+    late_time = 2.0f / plm_get_framerate(plm);
 
     /* Set SQ to YUV converter. */
     PVR_SET(PVR_YUV_ADDR, (((unsigned int)texture) & 0xffffff));
@@ -231,9 +300,10 @@ int Mpeg1Play(const char *filename, unsigned int buttons)
     PVR_SET(PVR_YUV_CFG, (((MPEG1_TEXTURE_HEIGHT / 16) - 1) << 8) | ((MPEG1_TEXTURE_WIDTH / 16) - 1));
     PVR_GET(PVR_YUV_CFG);
 
-    /* First frame */
-    plm_frame_t *frame = plm_decode_video(plm);
-    int decoded = 1;
+    /* Frames stay valid until the presentation side releases them. One more
+       than the queue holds is being uploaded while the queue refills. */
+    plm_set_video_retained_frames(plm, MPEG1_QUEUE_FRAMES + 1);
+    plm_set_video_drop_policy(plm, PLM_VIDEO_DROP_LATE);
 
     /* Init sound stream. */
     int samplerate = plm_get_samplerate(plm);
@@ -247,6 +317,18 @@ int Mpeg1Play(const char *filename, unsigned int buttons)
     snd_stream_queue_go(snd_hnd);
     audio_interval = audio_time;
 
+    /* Start decoding ahead. The decode thread runs at a lower priority, so
+       it only gets the time the presentation thread spends waiting. */
+    cond_init(&queue_cond);
+    mutex_lock(&queue_lock);
+    queue_head = queue_count = 0;
+    queue_ended = 0;
+    late_frames = shown_frames = dropped_frames = 0;
+    mutex_unlock(&queue_lock);
+    decode_stop = 0;
+    decode_thread = thd_create(0, decode_thread_func, NULL);
+    thd_set_prio(decode_thread, PRIO_DEFAULT + 1);
+
     while (!cancel)
     {
         /* Check cancel buttons. */
@@ -257,23 +339,44 @@ int Mpeg1Play(const char *filename, unsigned int buttons)
             cancel = 2; /* ABXY + START (Software reset) */
         MAPLE_FOREACH_END()
 
-        /* Decode */
-        if ((audio_time - audio_interval) >= frame->time)
+        /* Take the next frame once it is due. The audio clock advances in
+           steps of whole MP2 frames, so a frame is only dropped when it is
+           more than two frames behind. */
+        frame = NULL;
+        audio_clock = audio_time - audio_interval;
+        mutex_lock(&queue_lock);
+        while (queue_count && audio_clock >= queue[queue_head]->time)
         {
-            frame = plm_decode_video(plm);
-            if (!frame)
+            if (frame)
+            {
+                plm_release_video_frame(plm, frame);
+                late_frames++;
+            }
+            frame = queue[queue_head];
+            queue_head = (queue_head + 1) % MPEG1_QUEUE_FRAMES;
+            queue_count--;
+            if (audio_clock < frame->time + late_time)
                 break;
-            decoded = 1;
         }
-        snd_stream_poll(snd_hnd);
+        if (frame)
+            cond_signal(&queue_cond);
+        else if (queue_ended && !queue_count)
+        {
+            mutex_unlock(&queue_lock);
+            break;
+        }
+        mutex_unlock(&queue_lock);
 
         /* Render */
         pvr_wait_ready();
         pvr_scene_begin();
-        if (decoded)
+        if (frame)
         {
             app_on_video(plm, frame, 0);
-            decoded = 0;
+            plm_release_video_frame(plm, frame);
+            mutex_lock(&queue_lock);
+            shown_frames++;
+            mutex_unlock(&queue_lock);
         }
         pvr_list_begin(PVR_LIST_OP_POLY);
         display_draw();
@@ -281,6 +384,11 @@ int Mpeg1Play(const char *filename, unsigned int buttons)
         pvr_scene_finish();
     }
 
+    decode_stop = 1;
+    cond_signal(&queue_cond);
+    thd_join(decode_thread, NULL);
+    cond_destroy(&queue_cond);
+
     plm_destroy(plm);
     pvr_mem_free(texture);
     snd_stream_destroy(snd_hnd);
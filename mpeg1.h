@@ -1,6 +1,17 @@
 #ifndef _MPEG1_H_INCLUDED_
 #define _MPEG1_H_INCLUDED_
 
+typedef struct
+{
+    int queue_depth;    /* Frames decoded ahead of presentation */
+    int late_frames;    /* Frames skipped because a later one was already due */
+    int shown_frames;   /* Frames uploaded to the texture */
+    int dropped_frames; /* Late B-pictures skipped without decoding */
+} Mpeg1Stats;
+
 extern int Mpeg1Play(const char *filename, unsigned int buttons);
 
+/* Get the frame queue statistics of the current or last playback. */
+extern void Mpeg1GetStats(Mpeg1Stats *stats);
+
 #endif
@@ -25,7 +25,7 @@ SOFTWARE.
 #include "plmpeg.h"
 // This function gets called for each decoded video frame
 void my_video_callback(plm_t *plm, plm_frame_t *frame, void *user) {
-	// Do something with frame->y.data, frame->cr.data, frame->cb.data
+	// Do something with frame->display
 }
 // This function gets called for each decoded audio frame
 void my_audio_callback(plm_t *plm, plm_samples_t *frame, void *user) {
@@ -65,8 +65,9 @@ With the high-level interface you have two options to decode video & audio:
     of both streams is up to you.
 If you only want to decode video *or* audio through these functions, you should
 disable the other stream (plm_set_{video|audio}_enabled(FALSE))
-Video data is decoded into a struct with all 3 planes (Y, Cr, Cb) stored in
-separate buffers. You can either convert this to RGB on the CPU (slow) via the
+Video data is decoded into a struct with all 3 planes (Y, Cr, Cb) stored
+macroblock by macroblock in one display buffer, as the PVR's YUV converter
+takes them. You can either convert this to RGB on the CPU (slow) via the
 plm_frame_to_rgb() function or do it on the GPU with the following matrix:
 mat4 bt601 = mat4(
 	1.16438,  0.00000,  1.59603, -0.87079,
@@ -96,6 +97,17 @@ A buffer created with plm_buffer_create_with_capacity() is treated as a ring
 buffer, meaning that data that has already been read, will be discarded. In
 contrast, a buffer created with plm_buffer_create_for_appending() will keep all
 data written to it in memory. This enables seeking in the already loaded data.
+A buffer created with plm_buffer_create_with_segments() doesn't copy anything
+and reads the written data in place.
+Files that can be mapped into memory (e.g. on the romdisk) are not read at all,
+but decoded in place like a memory source. plm_create_with_filename() does this
+automatically. See plm_buffer_create_with_mapped_file().
+Files can also be read on a background thread, so that slow reads don't stall
+decoding. See plm_buffer_create_with_file_read_ahead().
+Separate instances share no mutable state, so they can be created and used on
+different threads at the same time; each instance must only be used by one
+thread at a time. The lookup tables shared by all video decoders are built
+once, by whichever decoder is created first.
 There should be no need to use the lower level plm_demux_*, plm_video_* and 
 plm_audio_* functions, if all you want to do is read/decode an MPEG-PS file.
 However, if you get raw mpeg1video data or raw mp2 audio data from a different
@@ -162,6 +174,8 @@ typedef struct {
 // Also note that the size of the plane does *not* denote the size of the 
 // displayed frame. The sizes of planes are always rounded up to the nearest
 // macroblock (16px).
+// The decoder doesn't store the planes separately; data is NULL and the
+// samples are found in the display data of the frame.
 
 typedef struct {
 	unsigned int width;
@@ -172,7 +186,10 @@ typedef struct {
 
 // Decoded Video Frame
 // width and height denote the desired display size of the frame. This may be
-// different from the internal size of the 3 planes.
+// different from the internal size of the 3 planes. display holds the planes
+// macroblock by macroblock: 64 bytes Cb, 64 bytes Cr and then the four 8x8
+// Y blocks, 384 bytes per macroblock. The display data must not be modified;
+// the decoder reuses macroblocks that it knows to be unchanged.
 
 typedef struct {
 	double time;
@@ -288,6 +305,34 @@ int plm_get_height(plm_t *self);
 double plm_get_framerate(plm_t *self);
 
 
+// Set the number of threads that decode the slices of each video picture in
+// parallel. See plm_video_set_slice_threads().
+
+void plm_set_video_slice_threads(plm_t *self, int threads);
+
+
+// Set the number of decoded frames the caller may hold on to. See
+// plm_video_set_retained_frames(). Frames returned by plm_decode_video() then
+// have to be handed back with plm_release_video_frame().
+
+void plm_set_video_retained_frames(plm_t *self, int count);
+void plm_release_video_frame(plm_t *self, plm_frame_t *frame);
+
+
+// Set which video pictures are skipped, the deadline for late ones and get
+// the number skipped. See plm_video_set_drop_policy().
+
+void plm_set_video_drop_policy(plm_t *self, int policy);
+void plm_set_video_deadline(plm_t *self, double time, double tolerance);
+int plm_get_video_dropped_frames(plm_t *self, int picture_type);
+
+
+// Set the scale at which video pictures are decoded, 1, 2 or 4. See
+// plm_video_set_scale().
+
+void plm_set_video_scale(plm_t *self, int scale);
+
+
 // Get or set whether audio decoding is enabled. Default TRUE.
 
 int plm_get_audio_enabled(plm_t *self);
@@ -408,6 +453,32 @@ int plm_seek(plm_t *self, double time, int seek_exact);
 plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 
 
+// Decode a thumbnail at 1/8 of the size from the DC coefficients of the next
+// I- or D-picture, see plm_video_decode_thumbnail(). plm_seek_thumbnail() first
+// jumps to the intra frame just before the desired time like plm_seek(), so
+// a strip of thumbnails for a whole file only reads the intra frames; with a
+// seek index loaded each one is a single jump.
+// Returns NULL if no I-picture could be found.
+
+plm_frame_t *plm_decode_thumbnail(plm_t *self);
+plm_frame_t *plm_seek_thumbnail(plm_t *self, double time);
+
+
+// Load a seek index for the video stream from a sidecar file generated by
+// tools/pl_mpeg_index. With an index, plm_seek() jumps straight to the intra
+// frame before the desired time instead of estimating and scanning. Returns
+// FALSE if the file could not be read or belongs to a different source.
+
+int plm_load_index(plm_t *self, const char *filename);
+
+
+// Set whether to record a seek index while playing. Intra frames are added as
+// the demuxer passes them, so seeking back into the part that has already
+// been played doesn't need to scan. Default FALSE.
+
+void plm_set_indexing(plm_t *self, int enabled);
+
+
 
 // -----------------------------------------------------------------------------
 // plm_buffer public API
@@ -421,8 +492,17 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 #endif
 
 
+// Define PLM_BUFFER_READ_AHEAD_SIZE to let plm_buffer_create_with_filename()
+// (and thus plm_create_with_filename()) read the file on a background thread
+// into a read-ahead queue of this many bytes. See
+// plm_buffer_create_with_file_read_ahead().
+
+// #define PLM_BUFFER_READ_AHEAD_SIZE (512 * 1024)
+
+
 // Create a buffer instance with a filename. Returns NULL if the file could not
-// be opened.
+// be opened. If the file can be mapped into memory, the buffer reads it in
+// place, otherwise the file is streamed.
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename);
 
@@ -433,6 +513,46 @@ plm_buffer_t *plm_buffer_create_with_filename(const char *filename);
 plm_buffer_t *plm_buffer_create_with_file(unsigned int fh, int close_when_done);
 
 
+// Create a buffer instance with a file handle that is read on a background
+// thread, so that slow reads (e.g. a CD seek) don't stall decoding. The thread
+// reads whole 2048 byte sectors into a queue of read_ahead_size bytes. It
+// starts reading when the queue drops below the low watermark and stops when
+// it reaches the high watermark. The file handle must not be used otherwise
+// while the buffer exists.
+
+plm_buffer_t *plm_buffer_create_with_file_read_ahead(unsigned int fh, int close_when_done, size_t read_ahead_size);
+
+
+// Set the low and high watermark of a read-ahead buffer in bytes. The default
+// is half of the queue and the whole queue.
+
+void plm_buffer_set_read_ahead_watermarks(plm_buffer_t *self, size_t low, size_t high);
+
+
+// Set whether the decoder waits for the read-ahead thread when the queue runs
+// dry. This is the default. When set to FALSE, decoding just returns NULL
+// until more data has arrived, without signalling the end of the file.
+
+void plm_buffer_set_read_ahead_blocking(plm_buffer_t *self, int blocking);
+
+
+// Get the number of bytes currently waiting in the read-ahead queue.
+
+size_t plm_buffer_get_read_ahead_available(plm_buffer_t *self);
+
+
+// Create a buffer instance that maps the file into memory instead of reading
+// it: fs_mmap() on KOS, which only the romdisk supports, mmap() elsewhere. Off
+// the Dreamcast fh must therefore be a POSIX file descriptor, i.e. fs_open()
+// has to map to open() (see tools/host/kos.h). The buffer then behaves like one
+// created with plm_buffer_create_with_memory(), so seeking doesn't touch the
+// file. Returns NULL if the file can't be mapped.
+// Pass TRUE to close_when_done to let plmpeg close the handle when
+// plm_destroy() is called. Otherwise it has to stay open until then.
+
+plm_buffer_t *plm_buffer_create_with_mapped_file(unsigned int fh, int close_when_done);
+
+
 // Create a buffer instance with a pointer to memory as source. This assumes
 // the whole file is in memory. The bytes are not copied. Pass 1 to 
 // free_when_done to let plmpeg call free() on the pointer when plm_destroy() 
@@ -455,6 +575,14 @@ plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity);
 plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity);
 
 
+// Create an empty buffer that references the data passed to plm_buffer_write()
+// in place instead of copying it. The data has to stay valid and unchanged
+// until it has been read. plm_create_with_memory() uses this to let the
+// decoders read packets straight from the demuxed memory.
+
+plm_buffer_t *plm_buffer_create_with_segments(void);
+
+
 // Destroy a buffer instance and free all data
 
 void plm_buffer_destroy(plm_buffer_t *self);
@@ -570,15 +698,50 @@ int plm_demux_has_ended(plm_demux_t *self);
 plm_packet_t *plm_demux_seek(plm_demux_t *self, double time, int type, int force_intra);
 
 
+// Set whether to record a seek index of the intra frame packets of
+// PLM_DEMUX_PACKET_VIDEO_1 while demuxing. Packets are only recorded while the
+// demuxer reads on from the part of the source that is already indexed, so
+// that the index has no gaps. This only makes sense when the underlying data
+// source is a file or fixed memory.
+
+void plm_demux_set_indexing(plm_demux_t *self, int enabled);
+
+
+// Read the whole data source once to build a complete seek index, then return
+// to the current position. Returns the number of intra frames in the index.
+
+int plm_demux_build_index(plm_demux_t *self);
+
+
+// Load a complete seek index from a sidecar file. This also fills the cached
+// start time and duration, so these don't have to be searched for. The file
+// is little endian: "PLMI", version (2), size of the data source and number
+// of entries as 32 bit values, the first and the last PTS of
+// PLM_DEMUX_PACKET_VIDEO_1 as 64 bit values in 90kHz ticks (all bits set if
+// there is none), followed by an entry for each intra frame packet: the 32 bit
+// byte offset just behind its start code and the 64 bit PTS. Returns FALSE if
+// the file could not be read or the size of the data source doesn't match.
+
+int plm_demux_load_index(plm_demux_t *self, const char *filename);
+
+
+// Get the number of intra frames in the seek index.
+
+int plm_demux_get_index_size(plm_demux_t *self);
+
+
 // Get the PTS of the first packet of this type. Returns PLM_PACKET_INVALID_TS
-// if not packet of this packet type can be found.
+// if not packet of this packet type can be found. The result is cached. For
+// PLM_DEMUX_PACKET_VIDEO_1 it's usually known without searching, because it's
+// picked up when the first packets are demuxed.
 
 double plm_demux_get_start_time(plm_demux_t *self, int type);
 
 
 // Get the duration for the specified packet type - i.e. the span between the
 // the first PTS and the last PTS in the data source. This only makes sense when
-// the underlying data source is a file or fixed memory.
+// the underlying data source is a file or fixed memory. The result is cached
+// until the size of the data source changes.
 
 double plm_demux_get_duration(plm_demux_t *self, int type);
 
@@ -595,6 +758,13 @@ plm_packet_t *plm_demux_decode(plm_demux_t *self);
 // Decode MPEG1 Video ("mpeg1") data into raw YCrCb frames
 
 
+// Define PLM_VIDEO_REFERENCE_IDCT to reconstruct every block with the plain
+// 8x8 IDCT followed by separate clamp and clear passes, instead of the fused
+// kernels. The output is identical; this is meant for checking the fast path.
+
+// #define PLM_VIDEO_REFERENCE_IDCT
+
+
 // Create a video decoder with a plm_buffer as source.
 
 plm_video_t *plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done);
@@ -629,6 +799,95 @@ int plm_video_get_height(plm_video_t *self);
 void plm_video_set_no_delay(plm_video_t *self, int no_delay);
 
 
+// Picture coding types
+
+#define PLM_VIDEO_PICTURE_TYPE_INTRA 1
+#define PLM_VIDEO_PICTURE_TYPE_PREDICTIVE 2
+#define PLM_VIDEO_PICTURE_TYPE_B 3
+#define PLM_VIDEO_PICTURE_TYPE_D 4
+
+
+// Frame drop policies for plm_video_set_drop_policy()
+
+#define PLM_VIDEO_DROP_NONE 0
+#define PLM_VIDEO_DROP_B 1
+#define PLM_VIDEO_DROP_LATE 2
+#define PLM_VIDEO_DROP_UNTIL_INTRA 3
+
+
+// Set which pictures are skipped instead of decoded. Only the picture header
+// is read, then the decoder jumps to the next picture start code. Skipped
+// frames are never returned and the time of the following frames stays
+// correct, so a player falling behind can use this to hold audio sync.
+//   PLM_VIDEO_DROP_NONE         decode everything (the default)
+//   PLM_VIDEO_DROP_B            skip all B-pictures; they are never used as
+//                               reference, so this costs no other frames
+//   PLM_VIDEO_DROP_LATE         skip B-pictures whose time is more than the
+//                               tolerance behind the deadline, see
+//                               plm_video_set_deadline()
+//   PLM_VIDEO_DROP_UNTIL_INTRA  skip everything up to the next I-picture,
+//                               then continue with PLM_VIDEO_DROP_NONE
+// Pictures that depend on a skipped reference picture are skipped as well.
+
+void plm_video_set_drop_policy(plm_video_t *self, int policy);
+
+
+// Set the deadline for PLM_VIDEO_DROP_LATE, i.e. the time in seconds of the
+// frame that is due now, and how far behind it a B-picture may be.
+
+void plm_video_set_deadline(plm_video_t *self, double time, double tolerance);
+
+
+// Get the number of pictures skipped by the drop policy so far, for one of
+// the PLM_VIDEO_PICTURE_TYPE_* or 0 for all of them.
+
+int plm_video_get_dropped_frames(plm_video_t *self, int picture_type);
+
+
+// Set the scale at which pictures are decoded: 1 for the full size (the
+// default), 2 for half or 4 for quarter of the width and height, e.g. for
+// picture-in-picture or an in-game monitor. The blocks are reconstructed
+// from their low frequency coefficients only and the motion vectors are
+// scaled down. The frames take a quarter or a sixteenth of the memory, but
+// all coefficients still have to be read, so the time saved is much smaller:
+// the sample video decodes in about 85% of the full size time at half and
+// 70% at quarter size on a PC. Small errors of the reduced prediction add up
+// until the next I-picture. The returned frames have the reduced size, in the same
+// macroblock ordered display format. Changing the scale while decoding
+// invalidates all frames and skips pictures up to the next I-picture.
+
+void plm_video_set_scale(plm_video_t *self, int scale);
+
+
+// Set the number of threads that decode the slices of each picture in
+// parallel, including the calling thread. Slices don't depend on each other,
+// so after a quick scan for their start codes they are handed out to a pool
+// of threads and plm_video_decode() waits for all of them before it updates
+// the reference frames. The default of 1 decodes on the calling thread only.
+// This only pays off on hosts with multiple cores; the Dreamcast has one.
+
+void plm_video_set_slice_threads(plm_video_t *self, int threads);
+
+
+// Set the number of decoded frames the caller may hold on to. Normally a frame
+// returned by plm_video_decode() is only valid until the next call. With a
+// count > 0 each picture is decoded into its own display buffer from a pool
+// of count + 3, and the frame stays valid until it is handed back with
+// plm_video_release_frame(). This allows decoding ahead of presentation,
+// e.g. into a queue filled by a separate thread. If more than count frames
+// are held, the oldest is reused. Changing the count invalidates all retained
+// frames. The default of 0 disables the pool.
+
+void plm_video_set_retained_frames(plm_video_t *self, int count);
+
+
+// Hand back a frame returned by plm_video_decode(), so that its display
+// buffer can be reused. This may be called from a different thread than the
+// one decoding. Does nothing when no frames are retained.
+
+void plm_video_release_frame(plm_video_t *self, plm_frame_t *frame);
+
+
 // Get the current internal time in seconds.
 
 double plm_video_get_time(plm_video_t *self);
@@ -658,6 +917,17 @@ int plm_video_has_ended(plm_video_t *self);
 plm_frame_t *plm_video_decode(plm_video_t *self);
 
 
+// Decode and return a thumbnail of the next I- or D-picture at 1/8 of its
+// width and height, in the same macroblock ordered format. Each pixel is the DC
+// coefficient of one block; the other coefficients are only read past and
+// the other pictures skipped by their start codes, so this is much cheaper
+// than plm_video_decode(). The frame time is that of the I-picture. The
+// returned frame is valid until the next call. Decoding with
+// plm_video_decode() afterwards continues at the next I-picture.
+
+plm_frame_t *plm_video_decode_thumbnail(plm_video_t *self);
+
+
 // Convert the YCrCb data of a frame into interleaved R G B data. The stride
 // specifies the width in bytes of the destination buffer. I.e. the number of
 // bytes from one line to the next. The stride must be at least 
@@ -748,6 +1018,23 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 #include <kos.h>
 #include <string.h>
 #include <stdlib.h>
+#include <assert.h>
+
+#if !defined(_arch_dreamcast)
+	#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+// Cache line prefetch; the pref instruction on SH4, a compiler hint elsewhere
+
+#if defined(_arch_dreamcast)
+	#define PLM_PREFETCH(addr) __asm__("pref @%0" : : "r"(addr))
+#else
+	#define PLM_PREFETCH(addr) __builtin_prefetch(addr)
+#endif
 
 
 //------------------------------------------------------------------------------
@@ -761,6 +1048,8 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 //                      |  y3  |
 //                      |_ y4 _|
 //
+#if defined(_arch_dreamcast)
+
 // SH4 calling convention states we get 8 float arguments. Perfect!
 static inline __attribute__((always_inline)) float pl_fipr(float x1, float x2, float x3, float x4, float y1, float y2, float y3, float y4)
 {
@@ -802,6 +1091,17 @@ static inline __attribute__((always_inline)) float pl_fipr(float x1, float x2, f
   return __y4;
 }
 
+#else
+
+static inline __attribute__((always_inline)) float pl_fipr(float x1, float x2, float x3, float x4, float y1, float y2, float y3, float y4)
+{
+  return x1 * y1 + x2 * y2 + x3 * y3 + x4 * y4;
+}
+
+#endif
+
+#if defined(_arch_dreamcast)
+
 // Default (8-bit, 1 byte at a time) DH`moop
 void * memmove_co (void *dest, const void *src, size_t len)
 {
@@ -857,6 +1157,15 @@ void * memmove_co (void *dest, const void *src, size_t len)
   return dest;
 }
 
+#else
+
+void * memmove_co (void *dest, const void *src, size_t len)
+{
+  return memmove(dest, src, len);
+}
+
+#endif
+
 #ifndef TRUE
 #define TRUE 1
 #define FALSE 0
@@ -880,6 +1189,7 @@ struct plm_t {
 	int has_ended;
 	int loop;
 	int has_decoders;
+	int reference_packets;
 
 	int video_enabled;
 	int video_packet_type;
@@ -901,10 +1211,13 @@ struct plm_t {
 };
 
 int plm_init_decoders(plm_t *self);
+int plm_buffer_is_fixed_mem(plm_buffer_t *self);
 void plm_handle_end(plm_t *self);
 void plm_read_video_packet(plm_buffer_t *buffer, void *user);
 void plm_read_audio_packet(plm_buffer_t *buffer, void *user);
 void plm_read_packets(plm_t *self, int requested_type);
+static int plm_seek_begin(plm_t *self, double *time, double *packet_time, int *audio_packet_type);
+static plm_frame_t *plm_seek_end(plm_t *self, plm_frame_t *frame, int audio_packet_type);
 
 plm_t *plm_create_with_filename(const char *filename) {
 	plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
@@ -928,6 +1241,9 @@ plm_t *plm_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_t *self = (plm_t *)PLM_MALLOC(sizeof(plm_t));
 	memset(self, 0, sizeof(plm_t));
 
+	// Packets in a memory buffer stay put, so the decoders can read them in
+	// place instead of copying them into buffers of their own
+	self->reference_packets = plm_buffer_is_fixed_mem(buffer);
 
 	self->demux = plm_demux_create(buffer, destroy_when_done);
 	self->video_enabled = TRUE;
@@ -950,7 +1266,9 @@ int plm_init_decoders(plm_t *self) {
 		if (self->video_enabled) {
 			self->video_packet_type = PLM_DEMUX_PACKET_VIDEO_1;
 		}
-		self->video_buffer = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+		self->video_buffer = self->reference_packets
+			? plm_buffer_create_with_segments()
+			: plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
 		plm_buffer_set_load_callback(self->video_buffer, plm_read_video_packet, self);
 	}
 
@@ -958,7 +1276,9 @@ int plm_init_decoders(plm_t *self) {
 		if (self->audio_enabled) {
 			self->audio_packet_type = PLM_DEMUX_PACKET_AUDIO_1 + self->audio_stream_index;
 		}
-		self->audio_buffer = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+		self->audio_buffer = self->reference_packets
+			? plm_buffer_create_with_segments()
+			: plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
 		plm_buffer_set_load_callback(self->audio_buffer, plm_read_audio_packet, self);
 	}
 
@@ -1071,6 +1391,48 @@ double plm_get_framerate(plm_t *self) {
 		: 0;
 }
 
+void plm_set_video_slice_threads(plm_t *self, int threads) {
+	if (plm_init_decoders(self) && self->video_decoder) {
+		plm_video_set_slice_threads(self->video_decoder, threads);
+	}
+}
+
+void plm_set_video_retained_frames(plm_t *self, int count) {
+	if (plm_init_decoders(self) && self->video_decoder) {
+		plm_video_set_retained_frames(self->video_decoder, count);
+	}
+}
+
+void plm_release_video_frame(plm_t *self, plm_frame_t *frame) {
+	if (self->video_decoder) {
+		plm_video_release_frame(self->video_decoder, frame);
+	}
+}
+
+void plm_set_video_drop_policy(plm_t *self, int policy) {
+	if (plm_init_decoders(self) && self->video_decoder) {
+		plm_video_set_drop_policy(self->video_decoder, policy);
+	}
+}
+
+void plm_set_video_deadline(plm_t *self, double time, double tolerance) {
+	if (self->video_decoder) {
+		plm_video_set_deadline(self->video_decoder, time, tolerance);
+	}
+}
+
+int plm_get_video_dropped_frames(plm_t *self, int picture_type) {
+	return self->video_decoder
+		? plm_video_get_dropped_frames(self->video_decoder, picture_type)
+		: 0;
+}
+
+void plm_set_video_scale(plm_t *self, int scale) {
+	if (plm_init_decoders(self) && self->video_decoder) {
+		plm_video_set_scale(self->video_decoder, scale);
+	}
+}
+
 int plm_get_num_audio_streams(plm_t *self) {
 	return plm_demux_get_num_audio_streams(self->demux);
 }
@@ -1275,13 +1637,18 @@ void plm_read_packets(plm_t *self, int requested_type) {
 	}
 }
 
-plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
+// Shared by plm_seek_frame() and plm_seek_thumbnail(): clamp time to the
+// duration, jump to the intra frame packet before it and hand that to the
+// rewound video decoder. Writing to the audio buffer is disabled until
+// plm_seek_end(). Returns FALSE if there is no video or no such packet.
+
+static int plm_seek_begin(plm_t *self, double *time, double *packet_time, int *audio_packet_type) {
 	if (!plm_init_decoders(self)) {
-		return NULL;
+		return FALSE;
 	}
 
 	if (!self->video_packet_type) {
-		return NULL;
+		return FALSE;
 	}
 
 	int type = self->video_packet_type;
@@ -1289,47 +1656,98 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 	double start_time = plm_demux_get_start_time(self->demux, type);
 	double duration = plm_demux_get_duration(self->demux, type);
 
-	if (time < 0) {
-		time = 0;
+	if (*time < 0) {
+		*time = 0;
 	}
-	else if (time > duration) {
-		time = duration;
+	else if (*time > duration) {
+		*time = duration;
 	}
 
-	plm_packet_t *packet = plm_demux_seek(self->demux, time, type, TRUE);
+	plm_packet_t *packet = plm_demux_seek(self->demux, *time, type, TRUE);
 	if (!packet) {
-		return NULL;
+		return FALSE;
 	}
 
 	// Disable writing to the audio buffer while decoding video
-	int previous_audio_packet_type = self->audio_packet_type;
+	*audio_packet_type = self->audio_packet_type;
 	self->audio_packet_type = 0;
 
-	// Clear video buffer and decode the found packet
+	// Clear video buffer and write the found packet
+	*packet_time = packet->pts - start_time;
 	plm_video_rewind(self->video_decoder);
-	plm_video_set_time(self->video_decoder, packet->pts - start_time);
+	plm_video_set_time(self->video_decoder, *packet_time);
 	plm_buffer_write(self->video_buffer, packet->data, packet->length);
+	return TRUE;
+}
+
+static plm_frame_t *plm_seek_end(plm_t *self, plm_frame_t *frame, int audio_packet_type) {
+	// Enable writing to the audio buffer again?
+	self->audio_packet_type = audio_packet_type;
+
+	if (frame) {
+		self->time = frame->time;
+	}
+
+	self->has_ended = FALSE;
+	return frame;
+}
+
+plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
+	double packet_time;
+	int audio_packet_type;
+	if (!plm_seek_begin(self, &time, &packet_time, &audio_packet_type)) {
+		return NULL;
+	}
+
 	plm_frame_t *frame = plm_video_decode(self->video_decoder);
 
 	// If we want to seek to an exact frame, we have to decode all frames
 	// on top of the intra frame we just jumped to.
 	if (seek_exact) {
 		while (frame && frame->time < time) {
+			plm_video_release_frame(self->video_decoder, frame);
 			frame = plm_video_decode(self->video_decoder);
 		}
 	}
 
-	// Enable writing to the audio buffer again?
-	self->audio_packet_type = previous_audio_packet_type;
+	return plm_seek_end(self, frame, audio_packet_type);
+}
+
+plm_frame_t *plm_decode_thumbnail(plm_t *self) {
+	if (!plm_init_decoders(self)) {
+		return NULL;
+	}
+
+	if (!self->video_packet_type) {
+		return NULL;
+	}
 
+	plm_frame_t *frame = plm_video_decode_thumbnail(self->video_decoder);
 	if (frame) {
 		self->time = frame->time;
 	}
-
-	self->has_ended = FALSE;
+	else if (plm_demux_has_ended(self->demux)) {
+		plm_handle_end(self);
+	}
 	return frame;
 }
 
+plm_frame_t *plm_seek_thumbnail(plm_t *self, double time) {
+	double packet_time;
+	int audio_packet_type;
+	if (!plm_seek_begin(self, &time, &packet_time, &audio_packet_type)) {
+		return NULL;
+	}
+
+	// The packet time is that of the I-picture itself
+	plm_frame_t *frame = plm_video_decode_thumbnail(self->video_decoder);
+	if (frame) {
+		frame->time = packet_time;
+	}
+
+	return plm_seek_end(self, frame, audio_packet_type);
+}
+
 int plm_seek(plm_t *self, double time, int seek_exact) {
 	plm_frame_t *frame = plm_seek_frame(self, time, seek_exact);
 
@@ -1372,6 +1790,18 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 	return TRUE;
 }
 
+int plm_load_index(plm_t *self, const char *filename) {
+	return plm_demux_load_index(self->demux, filename);
+}
+
+void plm_set_indexing(plm_t *self, int enabled) {
+	plm_demux_set_indexing(self->demux, enabled);
+}
+
+
+// Fills through the store queues, so this is Dreamcast only
+
+#if defined(_arch_dreamcast)
 
 void *memsetsh4(void *dest, const uint8_t val, size_t len) {
     uint8_t *ptr, *sq;
@@ -1397,6 +1827,14 @@ void *memsetsh4(void *dest, const uint8_t val, size_t len) {
     return dest;
 }
 
+#else
+
+void *memsetsh4(void *dest, const uint8_t val, size_t len) {
+    return memset(dest, val, len);
+}
+
+#endif
+
 // -----------------------------------------------------------------------------
 // plm_buffer implementation
 
@@ -1404,9 +1842,46 @@ enum plm_buffer_mode {
 	PLM_BUFFER_MODE_FILE,
 	PLM_BUFFER_MODE_FIXED_MEM,
 	PLM_BUFFER_MODE_RING,
-	PLM_BUFFER_MODE_APPEND
+	PLM_BUFFER_MODE_APPEND,
+	PLM_BUFFER_MODE_SEGMENTS
 };
 
+#define PLM_BUFFER_READ_AHEAD_SECTOR_SIZE 2048
+#define PLM_BUFFER_READ_AHEAD_CHUNK_SIZE (16 * PLM_BUFFER_READ_AHEAD_SECTOR_SIZE)
+
+// The queue is shared with the read-ahead thread and guarded by lock. The
+// thread only ever writes behind the filled bytes and the decoder only reads
+// from them, so the copies themselves happen without holding the lock.
+
+typedef struct {
+	kthread_t *thread;
+	mutex_t lock;
+	condvar_t cond;
+	uint8_t *bytes;
+	size_t size;
+	size_t read_index;
+	size_t filled;
+	size_t low_watermark;
+	size_t high_watermark;
+	size_t file_pos;
+	size_t seek_pos;
+	int generation;
+	int blocking;
+	int refilling;
+	int has_ended;
+	int stop;
+} plm_buffer_read_ahead_t;
+
+// A segment buffer is the concatenation of the written data, each piece at
+// its own address. start is the offset of a segment in that logical stream;
+// bit_index and length refer to the logical stream as well.
+
+typedef struct {
+	const uint8_t *bytes;
+	size_t start;
+	size_t length;
+} plm_buffer_segment_t;
+
 struct plm_buffer_t {
 	size_t bit_index;
 	size_t capacity;
@@ -1416,11 +1891,24 @@ struct plm_buffer_t {
 	int has_ended;
 	int free_when_done;
 	int close_when_done;
+	int unmap_when_done;
 	unsigned int fh;
 	plm_buffer_load_callback load_callback;
 	void *load_callback_user_data;
 	uint8_t *bytes;
 	enum plm_buffer_mode mode;
+	uint32_t cache;
+	size_t cache_index;
+	size_t cache_end;
+	size_t ring_start;
+	size_t load_request;
+	plm_buffer_read_ahead_t *read_ahead;
+	size_t scan_index;
+	int scan_code;
+	plm_buffer_segment_t *segments;
+	int segment_count;
+	int segment_capacity;
+	int segment_cursor;
 };
 
 typedef struct {
@@ -1433,32 +1921,81 @@ typedef struct {
 	uint16_t value;
 } plm_vlc_uint_t;
 
+// Two level lookup table entry, generated from a plm_vlc_t tree. The first
+// level is indexed by the next root_bits of the stream. Codes that don't fit
+// link to a second level table: length is 0, value is the offset of the
+// second level and extra the number of bits that index it. The length of
+// all other entries is the full code length, including the root bits.
+
+typedef struct {
+	int16_t value;
+	uint8_t length;
+	uint8_t extra;
+} plm_vlc_lut_t;
+
+// Decodes the code at the left-aligned bits into a lookup table entry. Returns
+// FALSE if more than the given number of bits is needed to resolve it.
+
+typedef int(*plm_vlc_lut_decode_callback)
+	(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry);
+
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos);
 size_t plm_buffer_tell(plm_buffer_t *self);
 void plm_buffer_discard_read_bytes(plm_buffer_t *self);
+void plm_buffer_discard_segments(plm_buffer_t *self, size_t byte_pos);
+plm_buffer_segment_t *plm_buffer_find_segment(plm_buffer_t *self, size_t index);
+uint8_t plm_buffer_get_byte(plm_buffer_t *self, size_t index);
+size_t plm_buffer_scan_segments(plm_buffer_t *self, size_t index, size_t end);
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user);
-
-inline int plm_buffer_has(plm_buffer_t *self, size_t count);
-inline int plm_buffer_read(plm_buffer_t *self, int count);
-inline void plm_buffer_align(plm_buffer_t *self);
-inline void plm_buffer_skip(plm_buffer_t *self, size_t count);
-inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
-inline int plm_buffer_next_start_code(plm_buffer_t *self);
-inline int plm_buffer_find_start_code(plm_buffer_t *self, int code);
-inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
-inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+size_t plm_buffer_read_file(plm_buffer_t *self, uint8_t *bytes, size_t length, size_t min_length);
+void *plm_buffer_read_ahead_thread(void *user);
+void plm_buffer_read_ahead_seek(plm_buffer_t *self, size_t pos);
+size_t plm_buffer_read_ahead_consume(plm_buffer_t *self, uint8_t *bytes, size_t length, size_t min_length);
+int plm_buffer_read_ahead_has_ended(plm_buffer_t *self);
+
+int plm_buffer_has(plm_buffer_t *self, size_t count);
+void plm_buffer_invalidate_cache(plm_buffer_t *self);
+void plm_buffer_fill_cache(plm_buffer_t *self);
+int plm_buffer_peek(plm_buffer_t *self, int count);
+void plm_buffer_consume(plm_buffer_t *self, int count);
+int plm_buffer_read(plm_buffer_t *self, int count);
+void plm_buffer_align(plm_buffer_t *self);
+void plm_buffer_skip(plm_buffer_t *self, size_t count);
+int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
+size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t index, size_t end);
+int plm_buffer_next_start_code(plm_buffer_t *self);
+int plm_buffer_find_start_code(plm_buffer_t *self, int code);
+int plm_buffer_has_start_code(plm_buffer_t *self, int code);
+int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count);
+int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
+uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+const plm_vlc_lut_t *plm_buffer_lookup_vlc(plm_buffer_t *self, const plm_vlc_lut_t *lut, int root_bits);
+int16_t plm_buffer_read_vlc_lut(plm_buffer_t *self, const plm_vlc_lut_t *lut, int root_bits, const plm_vlc_t *table);
+int plm_vlc_walk(const plm_vlc_t *table, uint32_t code, int bits, int16_t *value);
+int plm_vlc_lut_decode_tree(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry);
+int plm_vlc_lut_build(plm_vlc_lut_t *lut, int capacity, int root_bits, plm_vlc_lut_decode_callback decode, const void *user);
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
 	unsigned int fh = fs_open(filename, 0);
 	if (fh == -1) {
 		return NULL;
 	}
-	return plm_buffer_create_with_file(fh, TRUE);
+	plm_buffer_t *mapped = plm_buffer_create_with_mapped_file(fh, TRUE);
+	if (mapped) {
+		return mapped;
+	}
+	#ifdef PLM_BUFFER_READ_AHEAD_SIZE
+		return plm_buffer_create_with_file_read_ahead(fh, TRUE, PLM_BUFFER_READ_AHEAD_SIZE);
+	#else
+		return plm_buffer_create_with_file(fh, TRUE);
+	#endif
 }
 
 plm_buffer_t *plm_buffer_create_with_file(unsigned int fh, int close_when_done) {
-	plm_buffer_t *self = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+	// The second half mirrors the first, see plm_buffer_load_file_callback()
+	plm_buffer_t *self = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE * 2);
+	self->capacity = PLM_BUFFER_DEFAULT_SIZE;
 	self->fh = fh;
 	self->close_when_done = close_when_done;
 	self->mode = PLM_BUFFER_MODE_FILE;
@@ -1472,9 +2009,69 @@ plm_buffer_t *plm_buffer_create_with_file(unsigned int fh, int close_when_done)
 	return self;
 }
 
+plm_buffer_t *plm_buffer_create_with_file_read_ahead(unsigned int fh, int close_when_done, size_t read_ahead_size) {
+	plm_buffer_t *self = plm_buffer_create_with_file(fh, close_when_done);
+
+	// Whole sectors, and at least enough to fill the file ring in one go
+	read_ahead_size = (read_ahead_size + PLM_BUFFER_READ_AHEAD_SECTOR_SIZE - 1) &
+		~(PLM_BUFFER_READ_AHEAD_SECTOR_SIZE - 1);
+	if (read_ahead_size < self->capacity) {
+		read_ahead_size = self->capacity;
+	}
+
+	plm_buffer_read_ahead_t *ahead = (plm_buffer_read_ahead_t *)PLM_MALLOC(sizeof(plm_buffer_read_ahead_t));
+	memset(ahead, 0, sizeof(plm_buffer_read_ahead_t));
+	ahead->bytes = (uint8_t *)PLM_MALLOC(read_ahead_size);
+	ahead->size = read_ahead_size;
+	ahead->low_watermark = read_ahead_size / 2;
+	ahead->high_watermark = read_ahead_size;
+	ahead->blocking = TRUE;
+	ahead->refilling = TRUE;
+	mutex_init(&ahead->lock, MUTEX_TYPE_NORMAL);
+	cond_init(&ahead->cond);
+
+	self->read_ahead = ahead;
+	ahead->thread = thd_create(0, plm_buffer_read_ahead_thread, self);
+	return self;
+}
+
+plm_buffer_t *plm_buffer_create_with_mapped_file(unsigned int fh, int close_when_done) {
+	fs_seek(fh, 0, SEEK_END);
+	size_t length = fs_tell(fh);
+	fs_seek(fh, 0, SEEK_SET);
+	if (length == 0) {
+		return NULL;
+	}
+
+	#if defined(_arch_dreamcast)
+		// The romdisk hands out a pointer into its image; other file systems
+		// return NULL
+		uint8_t *bytes = (uint8_t *)fs_mmap(fh);
+		if (!bytes) {
+			return NULL;
+		}
+	#else
+		// Off the Dreamcast fh is handed to mmap() as is, so the fs_*() calls
+		// have to work on POSIX file descriptors, as in tools/host/kos.h
+		void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fh, 0);
+		if (map == MAP_FAILED) {
+			return NULL;
+		}
+		uint8_t *bytes = (uint8_t *)map;
+	#endif
+
+	plm_buffer_t *self = plm_buffer_create_with_memory(bytes, length, FALSE);
+	self->fh = fh;
+	self->close_when_done = close_when_done;
+	#if !defined(_arch_dreamcast)
+		self->unmap_when_done = TRUE;
+	#endif
+	return self;
+}
+
 plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int free_when_done) {
 	plm_buffer_t *self = (plm_buffer_t *)PLM_MALLOC(sizeof(plm_buffer_t));
-	memsetsh4(self, 0, sizeof(plm_buffer_t));
+	memset(self, 0, sizeof(plm_buffer_t));
 	self->capacity = length;
 	self->length = length;
 	self->total_size = length;
@@ -1482,6 +2079,7 @@ plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int f
 	self->bytes = bytes;
 	self->mode = PLM_BUFFER_MODE_FIXED_MEM;
 	self->discard_read_bytes = FALSE;
+	plm_buffer_invalidate_cache(self);
 	return self;
 }
 
@@ -1503,13 +2101,50 @@ plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity) {
 	return self;
 }
 
+plm_buffer_t *plm_buffer_create_with_segments(void) {
+	plm_buffer_t *self = (plm_buffer_t *)PLM_MALLOC(sizeof(plm_buffer_t));
+	memset(self, 0, sizeof(plm_buffer_t));
+	self->segment_capacity = 16;
+	self->segments = (plm_buffer_segment_t *)PLM_MALLOC(
+		self->segment_capacity * sizeof(plm_buffer_segment_t)
+	);
+	self->mode = PLM_BUFFER_MODE_SEGMENTS;
+	self->discard_read_bytes = TRUE;
+	return self;
+}
+
+int plm_buffer_is_fixed_mem(plm_buffer_t *self) {
+	return self->mode == PLM_BUFFER_MODE_FIXED_MEM;
+}
+
 void plm_buffer_destroy(plm_buffer_t *self) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	if (ahead) {
+		mutex_lock(&ahead->lock);
+		ahead->stop = TRUE;
+		cond_broadcast(&ahead->cond);
+		mutex_unlock(&ahead->lock);
+		thd_join(ahead->thread, NULL);
+
+		cond_destroy(&ahead->cond);
+		mutex_destroy(&ahead->lock);
+		PLM_FREE(ahead->bytes);
+		PLM_FREE(ahead);
+	}
+	#if !defined(_arch_dreamcast)
+		if (self->unmap_when_done) {
+			munmap(self->bytes, self->total_size);
+		}
+	#endif
 	if (self->fh && self->close_when_done) {
 		fs_close(self->fh);
 	}
 	if (self->free_when_done) {
 		PLM_FREE(self->bytes);
 	}
+	if (self->segments) {
+		PLM_FREE(self->segments);
+	}
 	PLM_FREE(self);
 }
 
@@ -1534,11 +2169,30 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 		// Seems to be good enough.
 
 		plm_buffer_discard_read_bytes(self);
-		if (self->mode == PLM_BUFFER_MODE_RING) {
+		if (
+			self->mode == PLM_BUFFER_MODE_RING ||
+			self->mode == PLM_BUFFER_MODE_SEGMENTS
+		) {
 			self->total_size = 0;
 		}
 	}
 
+	if (self->mode == PLM_BUFFER_MODE_SEGMENTS) {
+		if (self->segment_count == self->segment_capacity) {
+			self->segment_capacity *= 2;
+			self->segments = (plm_buffer_segment_t *)PLM_REALLOC(
+				self->segments, self->segment_capacity * sizeof(plm_buffer_segment_t)
+			);
+		}
+		plm_buffer_segment_t *segment = &self->segments[self->segment_count++];
+		segment->bytes = bytes;
+		segment->start = self->length;
+		segment->length = length;
+		self->length += length;
+		self->has_ended = FALSE;
+		return length;
+	}
+
 	// Do we have to resize to fit the new data?
 	size_t bytes_available = self->capacity - self->length;
 	if (bytes_available < length) {
@@ -1571,13 +2225,24 @@ void plm_buffer_rewind(plm_buffer_t *self) {
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 	self->has_ended = FALSE;
+	self->scan_index = 0;
+	plm_buffer_invalidate_cache(self);
 
 	if (self->mode == PLM_BUFFER_MODE_FILE) {
-		fs_seek(self->fh, pos, SEEK_SET);
+		if (self->read_ahead) {
+			plm_buffer_read_ahead_seek(self, pos);
+		}
+		else {
+			fs_seek(self->fh, pos, SEEK_SET);
+		}
 		self->bit_index = 0;
 		self->length = 0;
+		self->ring_start = 0;
 	}
-	else if (self->mode == PLM_BUFFER_MODE_RING) {
+	else if (
+		self->mode == PLM_BUFFER_MODE_RING ||
+		self->mode == PLM_BUFFER_MODE_SEGMENTS
+	) {
 		if (pos != 0) {
 			// Seeking to non-0 is forbidden for dynamic-mem buffers
 			return;
@@ -1585,6 +2250,8 @@ void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 		self->bit_index = 0;
 		self->length = 0;
 		self->total_size = 0;
+		self->segment_count = 0;
+		self->segment_cursor = 0;
 	}
 	else if (pos < self->length) {
 		self->bit_index = pos << 3;
@@ -1592,24 +2259,151 @@ void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 }
 
 size_t plm_buffer_tell(plm_buffer_t *self) {
-	return self->mode == PLM_BUFFER_MODE_FILE
-		? fs_tell(self->fh) + (self->bit_index >> 3) - self->length
-		: self->bit_index >> 3;
+	if (self->mode != PLM_BUFFER_MODE_FILE) {
+		return self->bit_index >> 3;
+	}
+	size_t file_pos = self->read_ahead
+		? self->read_ahead->file_pos
+		: (size_t)fs_tell(self->fh);
+	return file_pos + (self->bit_index >> 3) - self->length;
 }
 
 void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
+	size_t previous_bit_index = self->bit_index;
 	size_t byte_pos = self->bit_index >> 3;
+	if (byte_pos > 0) {
+		plm_buffer_invalidate_cache(self);
+	}
 	if (byte_pos == self->length) {
 		self->bit_index = 0;
 		self->length = 0;
+		self->ring_start = 0;
+		self->segment_count = 0;
+		self->segment_cursor = 0;
 	}
-	else if (byte_pos > 0) {
-		memmove_co(self->bytes, self->bytes + byte_pos, self->length - byte_pos);
+	else if (self->mode == PLM_BUFFER_MODE_SEGMENTS) {
+		if (byte_pos > 0) {
+			plm_buffer_discard_segments(self, byte_pos);
+		}
+	}
+	else if (self->mode == PLM_BUFFER_MODE_FILE) {
+		// Nothing to move for the file ring. Once the read position is past
+		// the end of the ring, continue at the same bytes in the first half.
+		if (byte_pos >= self->capacity) {
+			byte_pos -= self->capacity;
+			self->bit_index -= self->capacity << 3;
+			self->length -= self->capacity;
+		}
+		self->ring_start = byte_pos;
+	}
+	else if (byte_pos > 0) {
+		memmove_co(self->bytes, self->bytes + byte_pos, self->length - byte_pos);
 		self->bit_index -= byte_pos << 3;
 		self->length -= byte_pos;
 	}
+
+	// Move the end of the last start code scan along with the data
+	self->scan_index = self->scan_index > previous_bit_index
+		? self->scan_index - (previous_bit_index - self->bit_index)
+		: 0;
+}
+
+// Drop the segments before byte_pos and make it the start of the stream.
+// Nothing is copied but the segment list itself.
+
+void plm_buffer_discard_segments(plm_buffer_t *self, size_t byte_pos) {
+	int first = 0;
+	while (
+		first < self->segment_count &&
+		self->segments[first].start + self->segments[first].length <= byte_pos
+	) {
+		first++;
+	}
+
+	self->segment_count -= first;
+	for (int i = 0; i < self->segment_count; i++) {
+		plm_buffer_segment_t *segment = &self->segments[i];
+		*segment = self->segments[first + i];
+		if (segment->start < byte_pos) {
+			segment->bytes += byte_pos - segment->start;
+			segment->length -= byte_pos - segment->start;
+			segment->start = byte_pos;
+		}
+		segment->start -= byte_pos;
+	}
+	self->segment_cursor = 0;
+	self->bit_index -= byte_pos << 3;
+	self->length -= byte_pos;
+}
+
+// Return the segment holding the byte at index, which must be below length.
+// Reads mostly move forward, so start looking at the last segment found.
+
+plm_buffer_segment_t *plm_buffer_find_segment(plm_buffer_t *self, size_t index) {
+	int i = self->segment_cursor;
+	if (i >= self->segment_count || self->segments[i].start > index) {
+		i = 0;
+	}
+	while (self->segments[i].start + self->segments[i].length <= index) {
+		i++;
+	}
+	self->segment_cursor = i;
+	return &self->segments[i];
+}
+
+inline uint8_t plm_buffer_get_byte(plm_buffer_t *self, size_t index) {
+	if (self->mode != PLM_BUFFER_MODE_SEGMENTS) {
+		return self->bytes[index];
+	}
+	plm_buffer_segment_t *segment = plm_buffer_find_segment(self, index);
+	return segment->bytes[index - segment->start];
+}
+
+// plm_buffer_scan_start_code() for segment buffers. Each segment is scanned
+// in place; only the prefixes that straddle two segments are checked byte by
+// byte.
+
+size_t plm_buffer_scan_segments(plm_buffer_t *self, size_t index, size_t end) {
+	while (index < end) {
+		plm_buffer_segment_t *segment = plm_buffer_find_segment(self, index);
+		size_t segment_end = segment->start + segment->length;
+
+		size_t inner_end = segment_end > segment->start + 3 ? segment_end - 3 : segment->start;
+		if (inner_end > end) {
+			inner_end = end;
+		}
+		if (index < inner_end) {
+			size_t found = plm_buffer_scan_start_code(
+				segment->bytes, index - segment->start, inner_end - segment->start
+			) + segment->start;
+			if (found < inner_end) {
+				return found;
+			}
+			index = found;
+		}
+
+		for (; index < segment_end && index < end; index++) {
+			if (
+				plm_buffer_get_byte(self, index) == 0x00 &&
+				plm_buffer_get_byte(self, index + 1) == 0x00 &&
+				plm_buffer_get_byte(self, index + 2) == 0x01
+			) {
+				return index;
+			}
+		}
+	}
+	return end;
 }
 
+// File buffers are a ring of capacity bytes, followed by the same amount of
+// room to mirror its start. The unread data starting at ring_start is always
+// contiguous, even when it wraps around: every byte stored past the end of
+// the ring is also stored at the same offset from its start, so the reader
+// can continue there once plm_buffer_discard_read_bytes() wraps the read
+// position. Data is never moved; the only copy is the mirror of the few bytes
+// that straddle the end, and only as many as the pending plm_buffer_has()
+// needs.
+
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
 	PLM_UNUSED(user);
 
@@ -1617,25 +2411,209 @@ void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
 		plm_buffer_discard_read_bytes(self);
 	}
 
-	size_t bytes_available = self->capacity - self->length;
-	size_t bytes_read = fs_read(self->fh, self->bytes + self->length, bytes_available);
-	self->length += bytes_read;
-
-	if (bytes_read == 0) {
+	size_t bytes_read = 0;
+	size_t required_length = (self->bit_index + self->load_request + 7) >> 3;
+	if (self->length < self->capacity) {
+		size_t min_length = required_length > self->length
+			? (required_length < self->capacity ? required_length : self->capacity) - self->length
+			: 0;
+		bytes_read = plm_buffer_read_file(
+			self, self->bytes + self->length, self->capacity - self->length, min_length
+		);
+		self->length += bytes_read;
+	}
+
+	if (self->length >= self->capacity && self->length < required_length) {
+		// Read whole sectors past the end, but don't overwrite unread data
+		size_t mirror_length = (required_length - self->length + 2047) & ~2047;
+		size_t bytes_available = self->ring_start + self->capacity - self->length;
+		if (mirror_length > bytes_available) {
+			mirror_length = bytes_available;
+		}
+		size_t mirror_read = plm_buffer_read_file(
+			self, self->bytes + self->length, mirror_length, required_length - self->length
+		);
+		memcpy(
+			self->bytes + self->length - self->capacity,
+			self->bytes + self->length, mirror_read
+		);
+		self->length += mirror_read;
+		bytes_read += mirror_read;
+	}
+
+	if (bytes_read == 0 && (!self->read_ahead || plm_buffer_read_ahead_has_ended(self))) {
 		self->has_ended = TRUE;
 	}
 }
 
+// Read up to length bytes from the file or the read-ahead queue. A blocking
+// read-ahead waits until at least min_length bytes are there.
+
+size_t plm_buffer_read_file(plm_buffer_t *self, uint8_t *bytes, size_t length, size_t min_length) {
+	if (self->read_ahead) {
+		return plm_buffer_read_ahead_consume(self, bytes, length, min_length);
+	}
+	return fs_read(self->fh, bytes, length);
+}
+
+void *plm_buffer_read_ahead_thread(void *user) {
+	plm_buffer_t *self = (plm_buffer_t *)user;
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	int generation = 0;
+	size_t pos = 0;
+
+	mutex_lock(&ahead->lock);
+	while (!ahead->stop) {
+		if (generation != ahead->generation) {
+			generation = ahead->generation;
+			pos = ahead->seek_pos;
+			fs_seek(self->fh, pos, SEEK_SET);
+		}
+
+		if (ahead->filled >= ahead->high_watermark) {
+			ahead->refilling = FALSE;
+		}
+		else if (ahead->filled < ahead->low_watermark) {
+			ahead->refilling = TRUE;
+		}
+		if (!ahead->refilling || ahead->has_ended || ahead->filled == ahead->size) {
+			cond_wait(&ahead->cond, &ahead->lock);
+			continue;
+		}
+
+		// Read up to a sector boundary of the file, but never past the free
+		// space or the end of the queue
+		size_t write_index = (ahead->read_index + ahead->filled) % ahead->size;
+		size_t length = ahead->size - ahead->filled;
+		if (length > ahead->size - write_index) {
+			length = ahead->size - write_index;
+		}
+		if (length > PLM_BUFFER_READ_AHEAD_CHUNK_SIZE) {
+			length = PLM_BUFFER_READ_AHEAD_CHUNK_SIZE;
+		}
+		size_t end = (pos + length) & ~(PLM_BUFFER_READ_AHEAD_SECTOR_SIZE - 1);
+		if (end > pos) {
+			length = end - pos;
+		}
+
+		mutex_unlock(&ahead->lock);
+		ssize_t bytes_read = fs_read(self->fh, ahead->bytes + write_index, length);
+		mutex_lock(&ahead->lock);
+
+		if (generation != ahead->generation) {
+			continue; // Seeked while reading; drop it
+		}
+		if (bytes_read <= 0) {
+			ahead->has_ended = TRUE;
+		}
+		else {
+			pos += bytes_read;
+			ahead->filled += bytes_read;
+		}
+		cond_broadcast(&ahead->cond);
+	}
+	mutex_unlock(&ahead->lock);
+	return NULL;
+}
+
+void plm_buffer_read_ahead_seek(plm_buffer_t *self, size_t pos) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	mutex_lock(&ahead->lock);
+	ahead->generation++;
+	ahead->seek_pos = pos;
+	ahead->read_index = 0;
+	ahead->filled = 0;
+	ahead->refilling = TRUE;
+	ahead->has_ended = FALSE;
+	ahead->file_pos = pos;
+	cond_broadcast(&ahead->cond);
+	mutex_unlock(&ahead->lock);
+}
+
+size_t plm_buffer_read_ahead_consume(plm_buffer_t *self, uint8_t *bytes, size_t length, size_t min_length) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	if (min_length > ahead->size) {
+		min_length = ahead->size;
+	}
+
+	mutex_lock(&ahead->lock);
+	if (ahead->blocking) {
+		while (ahead->filled < min_length && !ahead->has_ended) {
+			ahead->refilling = TRUE;
+			cond_broadcast(&ahead->cond);
+			cond_wait(&ahead->cond, &ahead->lock);
+		}
+	}
+	if (length > ahead->filled) {
+		length = ahead->filled;
+	}
+	size_t read_index = ahead->read_index;
+	mutex_unlock(&ahead->lock);
+
+	size_t first = ahead->size - read_index;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(bytes, ahead->bytes + read_index, first);
+	memcpy(bytes + first, ahead->bytes, length - first);
+
+	mutex_lock(&ahead->lock);
+	ahead->read_index = (read_index + length) % ahead->size;
+	ahead->filled -= length;
+	ahead->file_pos += length;
+	cond_broadcast(&ahead->cond);
+	mutex_unlock(&ahead->lock);
+	return length;
+}
+
+int plm_buffer_read_ahead_has_ended(plm_buffer_t *self) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	mutex_lock(&ahead->lock);
+	int has_ended = ahead->has_ended && ahead->filled == 0;
+	mutex_unlock(&ahead->lock);
+	return has_ended;
+}
+
+void plm_buffer_set_read_ahead_watermarks(plm_buffer_t *self, size_t low, size_t high) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	if (!ahead) {
+		return;
+	}
+	mutex_lock(&ahead->lock);
+	ahead->high_watermark = high < ahead->size ? high : ahead->size;
+	ahead->low_watermark = low < ahead->high_watermark ? low : ahead->high_watermark;
+	cond_broadcast(&ahead->cond);
+	mutex_unlock(&ahead->lock);
+}
+
+void plm_buffer_set_read_ahead_blocking(plm_buffer_t *self, int blocking) {
+	if (self->read_ahead) {
+		self->read_ahead->blocking = blocking;
+	}
+}
+
+size_t plm_buffer_get_read_ahead_available(plm_buffer_t *self) {
+	plm_buffer_read_ahead_t *ahead = self->read_ahead;
+	if (!ahead) {
+		return 0;
+	}
+	mutex_lock(&ahead->lock);
+	size_t available = ahead->filled;
+	mutex_unlock(&ahead->lock);
+	return available;
+}
+
 inline int plm_buffer_has_ended(plm_buffer_t *self) {
 	return self->has_ended;
 }
 
-inline int plm_buffer_has(plm_buffer_t *self, size_t count) {
+int plm_buffer_has(plm_buffer_t *self, size_t count) {
 	if (((self->length << 3) - self->bit_index) >= count) {
 		return TRUE;
 	}
 
 	if (self->load_callback) {
+		self->load_request = count;
 		self->load_callback(self, self->load_callback_user_data);
 
 		if (((self->length << 3) - self->bit_index) >= count) {
@@ -1649,26 +2627,107 @@ inline int plm_buffer_has(plm_buffer_t *self, size_t count) {
 	return FALSE;
 }
 
-inline int plm_buffer_read(plm_buffer_t *self, int count) {
-	if (!plm_buffer_has(self, count)) {
-		return 0;
+// The bit reader serves plm_buffer_read() and friends from a 32 bit cache that
+// holds the bytes starting at cache_index, MSB first. The cache is keyed on
+// the bit position, so code that moves bit_index directly (the demuxer, the
+// audio frame sync, plm_buffer_has_start_code()) doesn't need to know about
+// it. Anything that changes the bytes behind a position must invalidate it.
+// The cache never holds bytes past the current length, so a cache hit also
+// means the data is available and plm_buffer_has() can be skipped.
+// Bytes are loaded individually: the read position is only byte aligned and
+// the SH4 traps on unaligned word loads.
+
+inline void plm_buffer_invalidate_cache(plm_buffer_t *self) {
+	self->cache_index = 0;
+	self->cache_end = 0;
+}
+
+void plm_buffer_fill_cache(plm_buffer_t *self) {
+	size_t byte_index = self->bit_index >> 3;
+	const uint8_t *p = self->bytes + byte_index;
+
+	self->cache_index = byte_index << 3;
+	if (self->mode == PLM_BUFFER_MODE_SEGMENTS && byte_index < self->length) {
+		plm_buffer_segment_t *segment = &self->segments[self->segment_cursor];
+		if (
+			self->segment_cursor >= self->segment_count ||
+			byte_index < segment->start ||
+			byte_index >= segment->start + segment->length
+		) {
+			segment = plm_buffer_find_segment(self, byte_index);
+		}
+		p = segment->bytes + (byte_index - segment->start);
+		if (byte_index + 4 > segment->start + segment->length) {
+			// Straddles two or more segments
+			uint32_t cache = 0;
+			size_t available = self->length - byte_index;
+			for (size_t i = 0; i < 4; i++) {
+				cache <<= 8;
+				if (i < available) {
+					cache |= plm_buffer_get_byte(self, byte_index + i);
+				}
+			}
+			self->cache = cache;
+			self->cache_end = self->cache_index + ((available < 4 ? available : 4) << 3);
+			return;
+		}
+	}
+
+	if (byte_index + 4 <= self->length) {
+		self->cache =
+			((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+			((uint32_t)p[2] << 8) | (uint32_t)p[3];
+		self->cache_end = self->cache_index + 32;
+		return;
+	}
+
+	size_t available = byte_index < self->length
+		? self->length - byte_index
+		: 0;
+	uint32_t cache = 0;
+	for (size_t i = 0; i < 4; i++) {
+		cache <<= 8;
+		if (i < available) {
+			cache |= p[i];
+		}
 	}
+	self->cache = cache;
+	self->cache_end = self->cache_index + (available << 3);
+}
 
-	int value = 0;
-	while (count) {
-		int current_byte = self->bytes[self->bit_index >> 3];
+// Return the next count (1--24) bits without advancing. Bits past the end of
+// the available data read as 0.
+
+inline int plm_buffer_peek(plm_buffer_t *self, int count) {
+	if (
+		self->bit_index < self->cache_index ||
+		self->bit_index + count > self->cache_end
+	) {
+		plm_buffer_fill_cache(self);
+	}
+	return (self->cache << (self->bit_index - self->cache_index)) >> (32 - count);
+}
 
-		int remaining = 8 - (self->bit_index & 7); // Remaining bits in byte
-		int read = remaining < count ? remaining : count; // Bits in self run
-		int shift = remaining - read;
-		int mask = (0xff >> (8 - read));
+inline void plm_buffer_consume(plm_buffer_t *self, int count) {
+	self->bit_index += count;
+}
 
-		value = (value << read) | ((current_byte & (mask << shift)) >> shift);
+// Read count (1--24) bits. Returns 0 without advancing if not enough data is
+// available.
 
-		self->bit_index += read;
-		count -= read;
+inline int plm_buffer_read(plm_buffer_t *self, int count) {
+	if (
+		self->bit_index < self->cache_index ||
+		self->bit_index + count > self->cache_end
+	) {
+		if (!plm_buffer_has(self, count)) {
+			return 0;
+		}
+		plm_buffer_fill_cache(self);
 	}
 
+	int value = (self->cache << (self->bit_index - self->cache_index)) >> (32 - count);
+	self->bit_index += count;
 	return value;
 }
 
@@ -1685,27 +2744,84 @@ inline void plm_buffer_skip(plm_buffer_t *self, size_t count) {
 inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
 	plm_buffer_align(self);
 	int skipped = 0;
-	while (plm_buffer_has(self, 8) && self->bytes[self->bit_index >> 3] == v) {
+	while (plm_buffer_has(self, 8) && plm_buffer_get_byte(self, self->bit_index >> 3) == v) {
 		self->bit_index += 8;
 		skipped++;
 	}
 	return skipped;
 }
 
+// Return the index of the first 00 00 01 prefix that starts before end, or end
+// if there is none. The byte after the prefix must be readable for every
+// index before end.
+// Bytes that can't be part of a prefix are skipped: if the third byte is
+// greater than 1, no prefix starts at any of the three positions. Runs without
+// any zero byte are skipped a word (or with SSE2 16 bytes) at a time; without
+// SSE2 the scan first steps to a word boundary byte by byte.
+
+inline size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t index, size_t end) {
+	while (index < end) {
+		#if defined(__SSE2__)
+			while (index + 16 <= end) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(bytes + index));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))) {
+					break;
+				}
+				index += 16;
+			}
+		#else
+			// Word loads have to be aligned on the SH4, so check the positions
+			// up to the next word boundary one at a time first
+			while (((uintptr_t)(bytes + index) & 3) && index < end) {
+				if (bytes[index] == 0x00 && bytes[index + 1] == 0x00 && bytes[index + 2] == 0x01) {
+					return index;
+				}
+				index++;
+			}
+			while (index + 4 <= end) {
+				uint32_t word = *(const uint32_t *)(bytes + index);
+				if ((word - 0x01010101) & ~word & 0x80808080) {
+					break;
+				}
+				index += 4;
+			}
+		#endif
+
+		if (index >= end) {
+			break;
+		}
+		uint8_t b = bytes[index + 2];
+		if (b > 1) {
+			index += 3;
+		}
+		else if (b == 0) {
+			index += bytes[index + 1] ? 2 : 1;
+		}
+		else if (bytes[index] == 0x00 && bytes[index + 1] == 0x00) {
+			return index;
+		}
+		else {
+			index += 3;
+		}
+	}
+	return end;
+}
+
 inline int plm_buffer_next_start_code(plm_buffer_t *self) {
 	plm_buffer_align(self);
 
+	// Scan everything that is available at once; only call plm_buffer_has()
+	// again when there are fewer than 5 bytes left, so it may load more data.
 	while (plm_buffer_has(self, (5 << 3))) {
-		size_t byte_index = (self->bit_index) >> 3;
-		if (
-			self->bytes[byte_index] == 0x00 &&
-			self->bytes[byte_index + 1] == 0x00 &&
-			self->bytes[byte_index + 2] == 0x01
-		) {
+		size_t end = self->length - 4;
+		size_t byte_index = self->mode == PLM_BUFFER_MODE_SEGMENTS
+			? plm_buffer_scan_segments(self, self->bit_index >> 3, end)
+			: plm_buffer_scan_start_code(self->bytes, self->bit_index >> 3, end);
+		if (byte_index < end) {
 			self->bit_index = (byte_index + 4) << 3;
-			return self->bytes[byte_index + 3];
+			return plm_buffer_get_byte(self, byte_index + 3);
 		}
-		self->bit_index += 8;
+		self->bit_index = end << 3;
 	}
 	return -1;
 }
@@ -1721,30 +2837,54 @@ inline int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
 	return -1;
 }
 
-inline int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
+// Remember where an unsuccessful scan stopped. The next scan for the same code
+// continues from there, so waiting for the rest of a large picture to arrive
+// doesn't scan the same bytes over and over again.
+
+int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
 	size_t previous_bit_index = self->bit_index;
 	int previous_discard_read_bytes = self->discard_read_bytes;
 
+	if (self->scan_code == code && self->scan_index > self->bit_index) {
+		self->bit_index = self->scan_index;
+	}
+
 	self->discard_read_bytes = FALSE;
 	int current = plm_buffer_find_start_code(self, code);
 
+	self->scan_code = code;
+	self->scan_index = current == -1 ? self->bit_index : 0;
 	self->bit_index = previous_bit_index;
 	self->discard_read_bytes = previous_discard_read_bytes;
 	return current;
 }
 
-inline int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
+int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
 	if (!plm_buffer_has(self, bit_count)) {
 		return FALSE;
 	}
 
-	int val = plm_buffer_read(self, bit_count);
-	self->bit_index -= bit_count;
-	return val != 0;
+	return plm_buffer_peek(self, bit_count) != 0;
 }
 
 inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
 	plm_vlc_t state = {0, 0};
+
+	// No code is longer than 16 bits. If that many are available, walk the
+	// tree on peeked bits and consume them in one go. Near the end of the data
+	// fall back to single bit reads, which may invoke the load callback.
+	if (((self->length << 3) - self->bit_index) >= 16) {
+		uint32_t bits = plm_buffer_peek(self, 16) << 16;
+		int count = 0;
+		do {
+			state = table[state.index + (bits >> 31)];
+			bits <<= 1;
+			count++;
+		} while (state.index > 0);
+		self->bit_index += count;
+		return state.value;
+	}
+
 	do {
 		state = table[state.index + plm_buffer_read(self, 1)];
 	} while (state.index > 0);
@@ -1755,6 +2895,103 @@ inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_
 	return (uint16_t)plm_buffer_read_vlc(self, (const plm_vlc_t *)table);
 }
 
+// Resolve the next code with one or two table lookups and consume it. The
+// caller has to make sure at least 24 bits are available.
+
+inline const plm_vlc_lut_t *plm_buffer_lookup_vlc(plm_buffer_t *self, const plm_vlc_lut_t *lut, int root_bits) {
+	uint32_t bits = (uint32_t)plm_buffer_peek(self, 24) << 8;
+	const plm_vlc_lut_t *entry = &lut[bits >> (32 - root_bits)];
+	if (entry->length == 0) {
+		entry = &lut[entry->value + ((bits << root_bits) >> (32 - entry->extra))];
+	}
+	self->bit_index += entry->length;
+	return entry;
+}
+
+// Table driven plm_buffer_read_vlc(). Falls back to walking the tree near
+// the end of the data, so the load callback is invoked just the same.
+
+inline int16_t plm_buffer_read_vlc_lut(plm_buffer_t *self, const plm_vlc_lut_t *lut, int root_bits, const plm_vlc_t *table) {
+	if (((self->length << 3) - self->bit_index) < 24) {
+		return plm_buffer_read_vlc(self, table);
+	}
+	return plm_buffer_lookup_vlc(self, lut, root_bits)->value;
+}
+
+// Walk a VLC tree on the left-aligned bits of code, exactly like
+// plm_buffer_read_vlc() would. Returns the number of bits used or 0 if the
+// code is longer than the given number of bits.
+
+int plm_vlc_walk(const plm_vlc_t *table, uint32_t code, int bits, int16_t *value) {
+	plm_vlc_t state = {0, 0};
+	int length = 0;
+	do {
+		if (length == bits) {
+			return 0;
+		}
+		state = table[state.index + ((code >> (31 - length)) & 1)];
+		length++;
+	} while (state.index > 0);
+	*value = state.value;
+	return length;
+}
+
+int plm_vlc_lut_decode_tree(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry) {
+	int16_t value;
+	int length = plm_vlc_walk((const plm_vlc_t *)user, code, bits, &value);
+	if (!length) {
+		return FALSE;
+	}
+	entry->value = value;
+	entry->length = length;
+	entry->extra = 0;
+	return TRUE;
+}
+
+// Generate a two level lookup table by decoding every possible bit pattern.
+// Because the entries come from the same walk the bitwise decoder does, the
+// table yields exactly the same values and code lengths - invalid codes
+// included. Returns the number of entries used or 0 if the table needs more
+// than capacity entries; nothing is written beyond them either way.
+
+int plm_vlc_lut_build(plm_vlc_lut_t *lut, int capacity, int root_bits, plm_vlc_lut_decode_callback decode, const void *user) {
+	int used = 1 << root_bits;
+	if (used > capacity) {
+		return 0;
+	}
+	for (int i = 0; i < (1 << root_bits); i++) {
+		uint32_t prefix = (uint32_t)i << (32 - root_bits);
+		if (decode(user, prefix, root_bits, &lut[i])) {
+			continue;
+		}
+
+		// Find the number of bits needed to resolve every code behind this
+		// prefix and fill a second level table with them
+		int link_bits = 1;
+		plm_vlc_lut_t probe;
+		for (int j = 0; j < (1 << link_bits); j++) {
+			uint32_t code = prefix | ((uint32_t)j << (32 - root_bits - link_bits));
+			if (!decode(user, code, root_bits + link_bits, &probe)) {
+				link_bits++;
+				j = -1;
+			}
+		}
+		if (used + (1 << link_bits) > capacity) {
+			return 0;
+		}
+
+		lut[i].value = used;
+		lut[i].length = 0;
+		lut[i].extra = link_bits;
+		for (int j = 0; j < (1 << link_bits); j++) {
+			uint32_t code = prefix | ((uint32_t)j << (32 - root_bits - link_bits));
+			decode(user, code, root_bits + link_bits, &lut[used + j]);
+		}
+		used += 1 << link_bits;
+	}
+	return used;
+}
+
 
 
 // ----------------------------------------------------------------------------
@@ -1764,6 +3001,14 @@ static const int PLM_START_PACK = 0xBA;
 static const int PLM_START_END = 0xB9;
 static const int PLM_START_SYSTEM = 0xBB;
 
+static const uint32_t PLM_DEMUX_INDEX_VERSION = 2;
+static const size_t PLM_DEMUX_INDEX_HEADER_SIZE = 32;
+
+typedef struct {
+	size_t offset;
+	double pts;
+} plm_demux_index_entry_t;
+
 struct plm_demux_t {
 	plm_buffer_t *buffer;
 	int destroy_buffer_when_done;
@@ -1783,6 +3028,21 @@ struct plm_demux_t {
 	int num_video_streams;
 	plm_packet_t current_packet;
 	plm_packet_t next_packet;
+	size_t packet_start;
+	int reading_from_start;
+
+	// Intra frame packets sorted by offset. The index has no gaps from
+	// index_start up to index_end/index_time; index_contiguous tells whether
+	// the demuxer has read on from there without a jump.
+	plm_demux_index_entry_t *index;
+	int index_size;
+	int index_capacity;
+	int index_enabled;
+	int index_complete;
+	int index_contiguous;
+	size_t index_start;
+	size_t index_end;
+	double index_time;
 };
 
 
@@ -1790,6 +3050,10 @@ void plm_demux_buffer_seek(plm_demux_t *self, size_t pos);
 double plm_demux_decode_time(plm_demux_t *self);
 plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_get_packet(plm_demux_t *self);
+int plm_demux_packet_is_intra(plm_packet_t *packet);
+void plm_demux_index_packet(plm_demux_t *self, plm_packet_t *packet);
+void plm_demux_index_add(plm_demux_t *self, size_t offset, double pts);
+uint32_t plm_demux_index_read_u32(const uint8_t *bytes);
 
 plm_demux_t *plm_demux_create(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_demux_t *self = (plm_demux_t *)PLM_MALLOC(sizeof(plm_demux_t));
@@ -1801,6 +3065,9 @@ plm_demux_t *plm_demux_create(plm_buffer_t *buffer, int destroy_when_done) {
 	self->start_time = PLM_PACKET_INVALID_TS;
 	self->duration = PLM_PACKET_INVALID_TS;
 	self->start_code = -1;
+	self->index_time = PLM_PACKET_INVALID_TS;
+	self->index_contiguous = TRUE;
+	self->reading_from_start = TRUE;
 
 	plm_demux_has_headers(self);
 	return self;
@@ -1810,6 +3077,9 @@ void plm_demux_destroy(plm_demux_t *self) {
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
+	if (self->index) {
+		PLM_FREE(self->index);
+	}
 	PLM_FREE(self);
 }
 
@@ -1890,6 +3160,8 @@ void plm_demux_rewind(plm_demux_t *self) {
 	self->current_packet.length = 0;
 	self->next_packet.length = 0;
 	self->start_code = -1;
+	self->index_contiguous = TRUE;
+	self->reading_from_start = TRUE;
 }
 
 int plm_demux_has_ended(plm_demux_t *self) {
@@ -1901,6 +3173,8 @@ void plm_demux_buffer_seek(plm_demux_t *self, size_t pos) {
 	self->current_packet.length = 0;
 	self->next_packet.length = 0;
 	self->start_code = -1;
+	self->index_contiguous = (pos <= self->index_end);
+	self->reading_from_start = (pos == 0);
 }
 
 double plm_demux_get_start_time(plm_demux_t *self, int type) {
@@ -1910,8 +3184,10 @@ double plm_demux_get_start_time(plm_demux_t *self, int type) {
 
 	int previous_pos = plm_buffer_tell(self->buffer);
 	int previous_start_code = self->start_code;
+	int previous_index_contiguous = self->index_contiguous;
 
 	// Find first video PTS
+	double start_time = PLM_PACKET_INVALID_TS;
 	plm_demux_rewind(self);
 	do {
 		plm_packet_t *packet = plm_demux_decode(self);
@@ -1919,12 +3195,14 @@ double plm_demux_get_start_time(plm_demux_t *self, int type) {
 			break;
 		}
 		if (packet->type == type) {
-			self->start_time = packet->pts;
+			start_time = packet->pts;
 		}
-	} while (self->start_time == PLM_PACKET_INVALID_TS);
+	} while (start_time == PLM_PACKET_INVALID_TS);
 
 	plm_demux_buffer_seek(self, previous_pos);
 	self->start_code = previous_start_code;
+	self->index_contiguous = previous_index_contiguous;
+	self->start_time = start_time;
 	return self->start_time;
 }
 
@@ -1940,6 +3218,7 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
 
 	size_t previous_pos = plm_buffer_tell(self->buffer);
 	int previous_start_code = self->start_code;
+	int previous_index_contiguous = self->index_contiguous;
 
 	// Find last video PTS. Start searching 64kb from the end and go further
 	// back if needed.
@@ -1969,10 +3248,216 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
 
 	plm_demux_buffer_seek(self, previous_pos);
 	self->start_code = previous_start_code;
+	self->index_contiguous = previous_index_contiguous;
 	self->last_file_size = file_size;
 	return self->duration;
 }
 
+void plm_demux_set_indexing(plm_demux_t *self, int enabled) {
+	// Packets passed while indexing was off are missing from the index. An
+	// empty index just starts here.
+	if (enabled && !self->index_enabled && !self->index_complete) {
+		size_t pos = plm_buffer_tell(self->buffer);
+		if (!self->index_size) {
+			self->index_start = pos;
+			self->index_end = pos;
+			self->index_time = PLM_PACKET_INVALID_TS;
+		}
+		self->index_contiguous = (pos <= self->index_end);
+	}
+	self->index_enabled = enabled;
+}
+
+int plm_demux_build_index(plm_demux_t *self) {
+	if (!plm_demux_has_headers(self)) {
+		return 0;
+	}
+
+	size_t previous_pos = plm_buffer_tell(self->buffer);
+	int previous_start_code = self->start_code;
+	int previous_index_enabled = self->index_enabled;
+
+	// Demuxing from the start with indexing enabled records every intra frame
+	// and marks the index complete at the end
+	self->index_size = 0;
+	self->index_complete = FALSE;
+	self->index_start = 0;
+	self->index_end = 0;
+	self->index_time = PLM_PACKET_INVALID_TS;
+	self->index_enabled = TRUE;
+	plm_demux_rewind(self);
+	while (plm_demux_decode(self)) {}
+
+	plm_demux_buffer_seek(self, previous_pos);
+	self->start_code = previous_start_code;
+	self->index_enabled = previous_index_enabled;
+	return self->index_size;
+}
+
+int plm_demux_load_index(plm_demux_t *self, const char *filename) {
+	int fh = fs_open(filename, 0);
+	if (fh == -1) {
+		return FALSE;
+	}
+
+	fs_seek(fh, 0, SEEK_END);
+	size_t file_size = fs_tell(fh);
+	fs_seek(fh, 0, SEEK_SET);
+
+	uint8_t header[PLM_DEMUX_INDEX_HEADER_SIZE];
+	if (
+		file_size < PLM_DEMUX_INDEX_HEADER_SIZE ||
+		fs_read(fh, header, sizeof(header)) != (ssize_t)sizeof(header) ||
+		memcmp(header, "PLMI", 4) != 0 ||
+		plm_demux_index_read_u32(header + 4) != PLM_DEMUX_INDEX_VERSION ||
+		plm_demux_index_read_u32(header + 8) != plm_buffer_get_size(self->buffer)
+	) {
+		fs_close(fh);
+		return FALSE;
+	}
+
+	// The entry count comes from the file; it must fit the rest of the file,
+	// which also keeps count * 12 from overflowing
+	size_t count = plm_demux_index_read_u32(header + 12);
+	if (count > (file_size - PLM_DEMUX_INDEX_HEADER_SIZE) / 12) {
+		fs_close(fh);
+		return FALSE;
+	}
+	size_t size = count * 12;
+	uint8_t *bytes = (uint8_t *)PLM_MALLOC(size + 1);
+	if (!bytes) {
+		fs_close(fh);
+		return FALSE;
+	}
+	int valid = (fs_read(fh, bytes, size) == (ssize_t)size);
+	fs_close(fh);
+	if (!valid) {
+		PLM_FREE(bytes);
+		return FALSE;
+	}
+
+	// plm_demux_seek() binary-searches the PTS and jumps to the offset, so
+	// the PTS must never decrease and every offset must be inside the file
+	size_t file_end = plm_buffer_get_size(self->buffer);
+	uint64_t previous_ticks = 0;
+	self->index_size = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint8_t *entry = bytes + i * 12;
+		size_t offset = plm_demux_index_read_u32(entry);
+		uint64_t ticks =
+			(uint64_t)plm_demux_index_read_u32(entry + 4) |
+			((uint64_t)plm_demux_index_read_u32(entry + 8) << 32);
+		if (offset >= file_end || ticks < previous_ticks) {
+			valid = FALSE;
+			break;
+		}
+		plm_demux_index_add(self, offset, (double)ticks / 90000.0);
+		previous_ticks = ticks;
+	}
+	PLM_FREE(bytes);
+
+	if (!valid) {
+		// Drop the entries read so far; the index is empty and starts here,
+		// as if indexing was just enabled
+		size_t pos = plm_buffer_tell(self->buffer);
+		self->index_size = 0;
+		self->index_complete = FALSE;
+		self->index_start = pos;
+		self->index_end = pos;
+		self->index_time = PLM_PACKET_INVALID_TS;
+		self->index_contiguous = TRUE;
+		return FALSE;
+	}
+
+	// The PTS range saves searching for the start time and duration
+	uint64_t first_ticks =
+		(uint64_t)plm_demux_index_read_u32(header + 16) |
+		((uint64_t)plm_demux_index_read_u32(header + 20) << 32);
+	uint64_t last_ticks =
+		(uint64_t)plm_demux_index_read_u32(header + 24) |
+		((uint64_t)plm_demux_index_read_u32(header + 28) << 32);
+	if (first_ticks != UINT64_MAX && last_ticks != UINT64_MAX) {
+		self->start_time = (double)first_ticks / 90000.0;
+		self->duration = (double)last_ticks / 90000.0 - self->start_time;
+		self->last_file_size = file_end;
+	}
+
+	self->index_complete = TRUE;
+	self->index_start = 0;
+	self->index_end = plm_buffer_get_size(self->buffer);
+	self->index_time = self->index_size
+		? self->index[self->index_size - 1].pts
+		: PLM_PACKET_INVALID_TS;
+	return TRUE;
+}
+
+int plm_demux_get_index_size(plm_demux_t *self) {
+	return self->index_size;
+}
+
+uint32_t plm_demux_index_read_u32(const uint8_t *bytes) {
+	return
+		(uint32_t)bytes[0] |
+		((uint32_t)bytes[1] << 8) |
+		((uint32_t)bytes[2] << 16) |
+		((uint32_t)bytes[3] << 24);
+}
+
+void plm_demux_index_add(plm_demux_t *self, size_t offset, double pts) {
+	if (self->index_size == self->index_capacity) {
+		self->index_capacity = self->index_capacity
+			? self->index_capacity * 2
+			: 64;
+		self->index = (plm_demux_index_entry_t *)PLM_REALLOC(
+			self->index, self->index_capacity * sizeof(plm_demux_index_entry_t)
+		);
+	}
+	self->index[self->index_size].offset = offset;
+	self->index[self->index_size].pts = pts;
+	self->index_size++;
+}
+
+void plm_demux_index_packet(plm_demux_t *self, plm_packet_t *packet) {
+	// Only extend the index if nothing was skipped since its end
+	if (
+		packet->type != PLM_DEMUX_PACKET_VIDEO_1 ||
+		!self->index_contiguous ||
+		self->index_complete ||
+		self->packet_start < self->index_end
+	) {
+		return;
+	}
+
+	if (packet->pts != PLM_PACKET_INVALID_TS) {
+		if (plm_demux_packet_is_intra(packet)) {
+			plm_demux_index_add(self, self->packet_start, packet->pts);
+		}
+
+		// Any intra frame further on has a later PTS than this packet
+		if (packet->pts > self->index_time) {
+			self->index_time = packet->pts;
+		}
+	}
+	self->index_end = self->packet_start + packet->length;
+}
+
+int plm_demux_packet_is_intra(plm_packet_t *packet) {
+	for (size_t i = 0; i + 6 < packet->length; i++) {
+		// Find the START_PICTURE code
+		if (
+			packet->data[i] == 0x00 &&
+			packet->data[i + 1] == 0x00 &&
+			packet->data[i + 2] == 0x01 &&
+			packet->data[i + 3] == 0x00
+		) {
+			// Bits 11--13 in the picture header contain the frame
+			// type, where 1=Intra
+			return (packet->data[i + 5] & 0x38) == 8;
+		}
+	}
+	return FALSE;
+}
+
 plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int force_intra) {
 	if (!plm_demux_has_headers(self)) {
 		return NULL;
@@ -2009,9 +3494,36 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 	}
 	seek_time += self->start_time;
 
-	for (int retry = 0; retry < 32; retry++) {
-		int found_packet_with_pts = FALSE;
-		int found_packet_in_range = FALSE;
+	// If the index covers the seek_time, jump straight to the last intra frame
+	// before it
+	if (
+		force_intra &&
+		type == PLM_DEMUX_PACKET_VIDEO_1 &&
+		self->index_size && (
+			self->index_complete || (
+				seek_time >= self->index[0].pts &&
+				seek_time < self->index_time
+			)
+		)
+	) {
+		int lo = 0;
+		int hi = self->index_size - 1;
+		while (lo < hi) {
+			int mid = (lo + hi + 1) >> 1;
+			if (self->index[mid].pts <= seek_time) {
+				lo = mid;
+			}
+			else {
+				hi = mid - 1;
+			}
+		}
+		plm_demux_buffer_seek(self, self->index[lo].offset);
+		return plm_demux_decode_packet(self, type);
+	}
+
+	for (int retry = 0; retry < 32; retry++) {
+		int found_packet_with_pts = FALSE;
+		int found_packet_in_range = FALSE;
 		long last_valid_packet_start = -1;
 		double first_packet_time = PLM_PACKET_INVALID_TS;
 
@@ -2066,21 +3578,8 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 			// later, when we know it's the last intra frame before desired
 			// seek time.
 			if (force_intra) {
-				for (size_t i = 0; i < packet->length - 6; i++) {
-					// Find the START_PICTURE code
-					if (
-						packet->data[i] == 0x00 &&
-						packet->data[i + 1] == 0x00 &&
-						packet->data[i + 2] == 0x01 &&
-						packet->data[i + 3] == 0x00
-					) {
-						// Bits 11--13 in the picture header contain the frame
-						// type, where 1=Intra
-						if ((packet->data[i + 5] & 0x38) == 8) {
-							last_valid_packet_start = packet_start;
-						}
-						break;
-					}
+				if (plm_demux_packet_is_intra(packet)) {
+					last_valid_packet_start = packet_start;
 				}
 			}
 
@@ -2153,6 +3652,17 @@ plm_packet_t *plm_demux_decode(plm_demux_t *self) {
 		}
 	} while (self->start_code != -1);
 
+	// Reading on from an index that starts at the beginning to the end means
+	// it's complete now
+	if (
+		self->index_enabled &&
+		self->index_contiguous &&
+		self->index_start == 0 &&
+		plm_buffer_has_ended(self->buffer)
+	) {
+		self->index_complete = TRUE;
+	}
+
 	return NULL;
 }
 
@@ -2172,6 +3682,9 @@ plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type) {
 	}
 
 	self->start_code = -1;
+	if (self->index_enabled) {
+		self->packet_start = plm_buffer_tell(self->buffer);
+	}
 
 	self->next_packet.type = type;
 	self->next_packet.length = plm_buffer_read(self->buffer, 16);
@@ -2204,6 +3717,19 @@ plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type) {
 		return NULL; // invalid
 	}
 
+	// The first video PTS read from the start is the start time. Picking it
+	// up here saves plm_demux_get_start_time() from rewinding to find it.
+	if (
+		self->reading_from_start &&
+		type == PLM_DEMUX_PACKET_VIDEO_1 &&
+		self->next_packet.pts != PLM_PACKET_INVALID_TS
+	) {
+		if (self->start_time == PLM_PACKET_INVALID_TS) {
+			self->start_time = self->next_packet.pts;
+		}
+		self->reading_from_start = FALSE;
+	}
+
 	return plm_demux_get_packet(self);
 }
 
@@ -2218,6 +3744,9 @@ plm_packet_t *plm_demux_get_packet(plm_demux_t *self) {
 	self->current_packet.pts = self->next_packet.pts;
 
 	self->next_packet.length = 0;
+	if (self->index_enabled) {
+		plm_demux_index_packet(self, &self->current_packet);
+	}
 	return &self->current_packet;
 }
 
@@ -2229,10 +3758,6 @@ plm_packet_t *plm_demux_get_packet(plm_demux_t *self) {
 // Inspired by Java MPEG-1 Video Decoder and Player by Zoltan Korandi
 // https://sourceforge.net/projects/javampeg1video/
 
-static const int PLM_VIDEO_PICTURE_TYPE_INTRA = 1;
-static const int PLM_VIDEO_PICTURE_TYPE_PREDICTIVE = 2;
-static const int PLM_VIDEO_PICTURE_TYPE_B = 3;
-
 static const int PLM_START_SEQUENCE = 0xB3;
 static const int PLM_START_SLICE_FIRST = 0x01;
 static const int PLM_START_SLICE_LAST = 0xAF;
@@ -2340,6 +3865,10 @@ static const int PLM_START_USER_DATA = 0xB2;
 	{      -1,    0}, {       0,  0x11},  //   1: 0x
 };
 
+ __attribute__((aligned(32))) static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_D[] = {
+	{      -1,    0}, {       0,  0x01},  //   0: x
+};
+
  __attribute__((aligned(32))) static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE[] = {
 	{  1 << 1,    0}, {       0, 0x0a},  //   0: x
 	{  2 << 1,    0}, {       0, 0x02},  //   1: 0x
@@ -2368,7 +3897,8 @@ static const int PLM_START_USER_DATA = 0xB2;
 	NULL,
 	PLM_VIDEO_MACROBLOCK_TYPE_INTRA,
 	PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE,
-	PLM_VIDEO_MACROBLOCK_TYPE_B
+	PLM_VIDEO_MACROBLOCK_TYPE_B,
+	PLM_VIDEO_MACROBLOCK_TYPE_D
 };
 
  __attribute__((aligned(32))) static const plm_vlc_t PLM_VIDEO_CODE_BLOCK_PATTERN[] = {
@@ -2626,6 +4156,33 @@ static const plm_vlc_t *PLM_VIDEO_DCT_SIZE[] = {
 	{       0,   0x1c01}, {       0,   0x1b01},  // 111: 0000 0000 0001 111x
 };
 
+// Lookup tables generated from the VLC trees above when the first decoder is
+// created, see plm_vlc_lut_build(). The sizes are the number of entries the
+// generator returns for the given root bits (the largest of a group of tables
+// sharing one size); tools/pl_mpeg_vlc_test.c checks
+// the tables against the trees.
+
+#define PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS 6
+#define PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_SIZE 134
+#define PLM_VIDEO_MACROBLOCK_TYPE_LUT_BITS 6
+#define PLM_VIDEO_MACROBLOCK_TYPE_LUT_SIZE 64
+#define PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_BITS 6
+#define PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_SIZE 108
+#define PLM_VIDEO_MOTION_LUT_BITS 6
+#define PLM_VIDEO_MOTION_LUT_SIZE 134
+#define PLM_VIDEO_DCT_SIZE_LUT_BITS 7
+#define PLM_VIDEO_DCT_SIZE_LUT_SIZE 130
+#define PLM_VIDEO_DCT_COEFF_LUT_BITS 8
+#define PLM_VIDEO_DCT_COEFF_LUT_SIZE 832
+
+// The dct_coeff tables fold the sign bit, end_of_block and escape into the
+// entries: value is the signed level and extra the run. There is one table
+// for the first coefficient of a non-intra block, where "1s" is a level 1
+// coefficient, and one for all others, where "10" is end_of_block.
+
+#define PLM_VIDEO_DCT_COEFF_END_OF_BLOCK 0xff
+#define PLM_VIDEO_DCT_COEFF_ESCAPE 0xfe
+
 typedef struct {
 	int full_px;
 	int is_set;
@@ -2634,6 +4191,58 @@ typedef struct {
 	int v;
 } plm_video_motion_t;
 
+// Slices are decoded in parallel by a context decoder for each thread, each
+// with a copy of the buffer to read the shared picture data. The decoding
+// thread scans the slices of a picture into a list of its own and publishes
+// it under the lock. The threads take the next slice from the list until none
+// are left; the last one to finish signals done.
+
+typedef struct {
+	size_t bit_index;
+	int slice;
+} plm_video_slice_t;
+
+typedef struct plm_video_slice_pool_t plm_video_slice_pool_t;
+
+typedef struct {
+	plm_video_slice_pool_t *pool;
+	kthread_t *thread;
+	plm_video_t *context;
+	plm_buffer_t buffer;
+} plm_video_slice_worker_t;
+
+struct plm_video_slice_pool_t {
+	mutex_t lock;
+	condvar_t cond;
+	condvar_t done;
+	int thread_count;
+	plm_video_slice_worker_t *workers;
+	plm_video_slice_t *slices;
+	int slice_count;
+	int slice_capacity;
+	plm_video_slice_t *scan;
+	int scan_capacity;
+	int next_slice;
+	int slices_done;
+	int active;
+	int generation;
+	int stop;
+};
+
+typedef struct {
+	uint32_t *display;
+	plm_frame_t frame;
+	int held;
+} plm_video_output_t;
+
+typedef struct {
+	mutex_t lock;
+	int retained;
+	int output_count;
+	plm_video_output_t *outputs;
+	uint8_t *data;
+} plm_video_frame_pool_t;
+
 struct plm_video_t {
 	double framerate;
 	double time;
@@ -2644,6 +4253,11 @@ struct plm_video_t {
 	int mb_height;
 	int mb_size;
 
+	int scale_shift;
+	int display_mb_width;
+	int display_mb_height;
+	int display_mb_size;
+
 	int luma_width;
 	int luma_height;
 
@@ -2666,7 +4280,6 @@ struct plm_video_t {
 	int mb_col;
 
 	int macroblock_type;
-	int macroblock_intra;
 
 	int dc_predictor[3];
 
@@ -2678,35 +4291,178 @@ struct plm_video_t {
 	plm_frame_t frame_backward;
 
 	uint8_t *frames_data;
+	uint32_t picture_serial;
+
+	plm_frame_t thumbnail;
+	uint8_t *thumbnail_data;
 
-	int block_data[64];
+	__attribute__((aligned(32))) int16_t block_data[64];
 	uint8_t intra_quant_matrix[64];
 	uint8_t non_intra_quant_matrix[64];
 
+	// quantizer_scale * quant_matrix in zig-zag order, non-intra and intra,
+	// and the quantizer_scale each was built for; see plm_video_quant_table()
+	uint16_t quant_table[2][64];
+	int quant_table_scale[2];
+
 	int has_reference_frame;
 	int assume_no_b_frames;
+
+	int drop_policy;
+	double drop_deadline;
+	double drop_tolerance;
+	int dropped_frames[4];
+	int broken_references;
+	int reference_dropped;
+	int frames_dropped_pending;
+
+	plm_video_slice_pool_t *slice_pool;
+	plm_video_frame_pool_t *frame_pool;
 };
 
+// The lookup tables only depend on the constant VLC trees, so they are shared
+// by all decoders. The first one builds them under a once-guard; the others
+// wait in plm_video_init_vlc_luts() until they are complete.
+
+typedef struct {
+	plm_vlc_lut_t macroblock_address_increment[PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_SIZE];
+	plm_vlc_lut_t macroblock_type[4][PLM_VIDEO_MACROBLOCK_TYPE_LUT_SIZE];
+	plm_vlc_lut_t code_block_pattern[PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_SIZE];
+	plm_vlc_lut_t motion_code[PLM_VIDEO_MOTION_LUT_SIZE];
+	plm_vlc_lut_t dct_size[2][PLM_VIDEO_DCT_SIZE_LUT_SIZE];
+	plm_vlc_lut_t dct_coeff[2][PLM_VIDEO_DCT_COEFF_LUT_SIZE];
+} plm_video_vlc_luts_t;
+
+static plm_video_vlc_luts_t plm_video_vlc_luts;
+static kthread_once_t plm_video_vlc_luts_once = KTHREAD_ONCE_INIT;
+
+// Clamp to 0..255 with a table lookup instead of two compares and branches,
+// as this is done for every reconstructed pixel. The index is biased so that
+// negative values land in the leading zeros. Nearly all pixels of real
+// streams fall within the table, but the IDCT of legal extreme coefficients
+// reaches about +-14000, so a single unsigned compare sends everything outside
+// to the plain clamp.
+
+#define PLM_CLAMP_TABLE_BIAS 2048
+#define PLM_CLAMP_TABLE_MASK 4095
+
+static uint8_t plm_clamp_table[PLM_CLAMP_TABLE_MASK + 1];
+static kthread_once_t plm_clamp_table_once = KTHREAD_ONCE_INIT;
+
 static inline uint8_t plm_clamp(int n) {
-	if (n > 255) {
-		n = 255;
+	unsigned int index = (unsigned int)(n + PLM_CLAMP_TABLE_BIAS);
+	if (index <= PLM_CLAMP_TABLE_MASK) {
+		return plm_clamp_table[index];
 	}
-	else if (n < 0) {
-		n = 0;
-	}
-	return n;
+	return n < 0 ? 0 : 255;
+}
+
+// Each display buffer is followed by the serial of the picture that wrote
+// each of its macroblocks. Macroblocks with the same nonzero serial hold the
+// same data, so skipped macroblocks only need to be copied where it differs.
+// At a reduced scale the display holds fewer, but the serials are still kept
+// for each decoded macroblock.
+
+static inline size_t plm_video_display_size(plm_video_t *self) {
+	return (self->display_mb_size * 384 + self->mb_size * sizeof(uint32_t) + 31) & ~31;
+}
+
+static inline uint32_t *plm_video_mb_serials(plm_video_t *self, uint32_t *display) {
+	return display + self->display_mb_size * 96;
+}
+
+// At a reduced scale each macroblock of the picture only covers a part of a
+// display macroblock: 8x8 luma and 4x4 chroma pixels at half, 4x4 and 2x2 at
+// quarter scale. Get where its luma and chroma areas start; both are rows of
+// 8 bytes in the blocks of the display macroblock.
+
+static inline void plm_video_reduced_area(
+	plm_video_t *self, uint32_t *display, int address, uint8_t **luma, uint8_t **chroma
+) {
+	int shift = self->scale_shift;
+	int mask = (1 << shift) - 1;
+	int size = 16 >> shift;
+	int row = address / self->mb_width;
+	int col = address % self->mb_width;
+	uint8_t *mb = (uint8_t *)(display +
+		((row >> shift) * self->display_mb_width + (col >> shift)) * 96);
+
+	int x = (col & mask) * size;
+	int y = (row & mask) * size;
+	*luma = mb + 128 + (y >> 3) * 128 + (x >> 3) * 64 + (y & 7) * 8 + (x & 7);
+	*chroma = mb + (y >> 1) * 8 + (x >> 1);
 }
 
+void plm_video_init_vlc_luts(void);
+void plm_video_build_vlc_luts(void);
+void plm_video_build_vlc_lut(plm_vlc_lut_t *lut, int size, int root_bits, plm_vlc_lut_decode_callback decode, const void *user);
+void plm_init_clamp_table(void);
+void plm_build_clamp_table(void);
+int plm_video_decode_dct_coeff(const plm_vlc_t *table, int first, uint32_t code, int bits, plm_vlc_lut_t *entry);
+int plm_video_decode_dct_coeff_first(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry);
+int plm_video_decode_dct_coeff_next(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry);
 int plm_video_decode_sequence_header(plm_video_t *self);
+void plm_video_init_frames(plm_video_t *self);
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base);
-void plm_video_decode_picture(plm_video_t *self);
+int plm_video_decode_picture(plm_video_t *self);
+int plm_video_drop_picture(plm_video_t *self);
 void plm_video_decode_slice(plm_video_t *self, int slice);
-void plm_video_decode_macroblock(plm_video_t *self);
+void plm_video_init_thumbnail(plm_video_t *self);
+void plm_video_decode_thumbnail_slice(plm_video_t *self, int slice);
+void plm_video_skip_coefficients(plm_video_t *self);
+static inline int plm_frame_luma_offset(int mb_width, int x, int y);
+static inline int plm_frame_chroma_offset(int mb_width, int x, int y);
+void plm_video_decode_slices_threaded(plm_video_t *self);
+void plm_video_init_slice_context(plm_video_t *context, plm_video_t *self);
+void *plm_video_slice_thread(void *user);
+void plm_video_slice_work(plm_video_slice_worker_t *worker);
+void plm_video_frame_pool_acquire(plm_video_t *self);
+plm_frame_t *plm_video_frame_pool_retain(plm_video_t *self, plm_frame_t *frame);
+void plm_video_decode_macroblocks_intra(plm_video_t *self);
+void plm_video_decode_macroblocks_predictive(plm_video_t *self);
+void plm_video_decode_macroblocks_b(plm_video_t *self);
+void plm_video_decode_macroblocks_d(plm_video_t *self);
+void plm_video_copy_skipped(plm_video_t *self, plm_frame_t *reference, int address, int count);
+void plm_video_copy_reduced(plm_video_t *self, uint32_t *dest, uint32_t *src, int address);
+plm_frame_t *plm_video_skipped_reference(plm_video_t *self);
 void plm_video_decode_motion_vectors(plm_video_t *self);
 void plm_video_predict_macroblock(plm_video_t *self);
+// The blocks covered by the prediction of one macroblock from a reference;
+// y is a 3x3 grid of 8x8 blocks, cb and cr use the top left 2x2 of the same
+// grid layout. (x, y) is the position of the area within the top left block
+// and mode its (odd_v << 1) | odd_h.
+
+typedef struct {
+	const uint32_t *y[9];
+	const uint32_t *cb[5];
+	const uint32_t *cr[5];
+	int y_x, y_y, y_mode;
+	int c_x, c_y, c_mode;
+} plm_video_mc_source_t;
+
+typedef void (*plm_video_mc_block_t)(uint32_t *dest, const uint32_t **src, int x, int y);
+typedef void (*plm_video_mc_bidir_block_t)(
+	uint32_t *dest, const uint32_t **src, int x, int y,
+	const uint32_t **src2, int x2, int y2
+);
+void plm_video_mc_source(plm_video_mc_source_t *source, plm_frame_t *reference, int motion_h, int motion_v);
+void plm_video_mc_luma_source(plm_video_mc_source_t *source, plm_frame_t *reference, int hp, int vp);
+void plm_video_mc_chroma_source(plm_video_mc_source_t *source, plm_frame_t *reference, int hp, int vp);
+void plm_video_mc_reduced_source(plm_video_t *self, plm_video_mc_source_t *source, plm_frame_t *reference, plm_video_motion_t *motion);
+void plm_video_mc_reduced_block(uint8_t *d, int size, const uint32_t **src, int x, int y, int mode, const uint32_t **src2, int x2, int y2, int mode2);
+void plm_video_predict_reduced_macroblock(plm_video_t *self);
 void plm_video_copy_macroblock(uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v);
-void plm_video_interpolate_macroblock(uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v);
-void plm_video_decode_block(plm_video_t *self, int block);
+void plm_video_interpolate_macroblock(uint32_t *dest, plm_frame_t *forward, int forward_h, int forward_v, plm_frame_t *backward, int backward_h, int backward_v);
+void plm_video_decode_intra_luma_block(plm_video_t *self, int block);
+void plm_video_decode_intra_chroma_block(plm_video_t *self, int block);
+void plm_video_decode_non_intra_luma_block(plm_video_t *self, int block);
+void plm_video_decode_non_intra_chroma_block(plm_video_t *self, int block);
+void plm_video_decode_dc_luma_block(plm_video_t *self, int block);
+void plm_video_decode_dc_chroma_block(plm_video_t *self, int block);
+void plm_video_build_quant_table(plm_video_t *self, int intra);
+void plm_video_reconstruct_block(int16_t *block, uint8_t *d, int n, int rows, int cols, int add);
+void plm_video_reconstruct_block_reference(int16_t *block, uint8_t *d, int add);
+void plm_video_reconstruct_reduced(int16_t *block, uint8_t *d, int size, int rows, int cols, int add);
 void plm_video_idct(int *block);
 
 plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
@@ -2715,6 +4471,8 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 
 	self->buffer = buffer;
 	self->destroy_buffer_when_done = destroy_when_done;
+	plm_video_init_vlc_luts();
+	plm_init_clamp_table();
 
 	// Attempt to decode the sequence header
 	self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
@@ -2724,7 +4482,129 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 	return self;
 }
 
+void plm_init_clamp_table(void) {
+	// Shared by all decoders, like the VLC lookup tables
+	kthread_once(&plm_clamp_table_once, plm_build_clamp_table);
+}
+
+void plm_build_clamp_table(void) {
+	for (int i = 0; i <= PLM_CLAMP_TABLE_MASK; i++) {
+		int n = i - PLM_CLAMP_TABLE_BIAS;
+		plm_clamp_table[i] = n < 0 ? 0 : n > 255 ? 255 : n;
+	}
+}
+
+void plm_video_init_vlc_luts(void) {
+	kthread_once(&plm_video_vlc_luts_once, plm_video_build_vlc_luts);
+}
+
+void plm_video_build_vlc_luts(void) {
+	plm_video_vlc_luts_t *luts = &plm_video_vlc_luts;
+	plm_video_build_vlc_lut(
+		luts->macroblock_address_increment,
+		PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_SIZE, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS,
+		plm_vlc_lut_decode_tree, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+	);
+	for (int i = 0; i < 4; i++) {
+		plm_video_build_vlc_lut(
+			luts->macroblock_type[i],
+			PLM_VIDEO_MACROBLOCK_TYPE_LUT_SIZE, PLM_VIDEO_MACROBLOCK_TYPE_LUT_BITS,
+			plm_vlc_lut_decode_tree, PLM_VIDEO_MACROBLOCK_TYPE[i + 1]
+		);
+	}
+	plm_video_build_vlc_lut(
+		luts->code_block_pattern,
+		PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_SIZE, PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_BITS,
+		plm_vlc_lut_decode_tree, PLM_VIDEO_CODE_BLOCK_PATTERN
+	);
+	plm_video_build_vlc_lut(
+		luts->motion_code,
+		PLM_VIDEO_MOTION_LUT_SIZE, PLM_VIDEO_MOTION_LUT_BITS,
+		plm_vlc_lut_decode_tree, PLM_VIDEO_MOTION
+	);
+	for (int i = 0; i < 2; i++) {
+		plm_video_build_vlc_lut(
+			luts->dct_size[i],
+			PLM_VIDEO_DCT_SIZE_LUT_SIZE, PLM_VIDEO_DCT_SIZE_LUT_BITS,
+			plm_vlc_lut_decode_tree, PLM_VIDEO_DCT_SIZE[i]
+		);
+	}
+	plm_video_build_vlc_lut(
+		luts->dct_coeff[0],
+		PLM_VIDEO_DCT_COEFF_LUT_SIZE, PLM_VIDEO_DCT_COEFF_LUT_BITS,
+		plm_video_decode_dct_coeff_first, PLM_VIDEO_DCT_COEFF
+	);
+	plm_video_build_vlc_lut(
+		luts->dct_coeff[1],
+		PLM_VIDEO_DCT_COEFF_LUT_SIZE, PLM_VIDEO_DCT_COEFF_LUT_BITS,
+		plm_video_decode_dct_coeff_next, PLM_VIDEO_DCT_COEFF
+	);
+}
+
+void plm_video_build_vlc_lut(plm_vlc_lut_t *lut, int size, int root_bits, plm_vlc_lut_decode_callback decode, const void *user) {
+	// A table that does not fit means the sizes above are out of date
+	int used = plm_vlc_lut_build(lut, size, root_bits, decode, user);
+	assert(used > 0 && used <= size);
+	PLM_UNUSED(used);
+}
+
+// Decode a dct_coeff code the way plm_video_decode_block_of() reads it from the
+// tree, including the sign bit and the end_of_block check.
+
+int plm_video_decode_dct_coeff(const plm_vlc_t *table, int first, uint32_t code, int bits, plm_vlc_lut_t *entry) {
+	int16_t value;
+	int length = plm_vlc_walk(table, code, bits, &value);
+	if (!length) {
+		return FALSE;
+	}
+
+	uint16_t coeff = (uint16_t)value;
+	if (coeff == 0xffff) {
+		entry->value = 0;
+		entry->length = length;
+		entry->extra = PLM_VIDEO_DCT_COEFF_ESCAPE;
+		return TRUE;
+	}
+
+	if (coeff == 0x0001 && !first) {
+		if (length == bits) {
+			return FALSE;
+		}
+		int bit = (code >> (31 - length)) & 1;
+		length++;
+		if (!bit) {
+			entry->value = 0;
+			entry->length = length;
+			entry->extra = PLM_VIDEO_DCT_COEFF_END_OF_BLOCK;
+			return TRUE;
+		}
+	}
+
+	if (length == bits) {
+		return FALSE;
+	}
+	int level = coeff & 0xff;
+	if ((code >> (31 - length)) & 1) {
+		level = -level;
+	}
+	entry->value = level;
+	entry->length = length + 1;
+	entry->extra = coeff >> 8;
+	return TRUE;
+}
+
+int plm_video_decode_dct_coeff_first(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry) {
+	return plm_video_decode_dct_coeff((const plm_vlc_t *)user, TRUE, code, bits, entry);
+}
+
+int plm_video_decode_dct_coeff_next(const void *user, uint32_t code, int bits, plm_vlc_lut_t *entry) {
+	return plm_video_decode_dct_coeff((const plm_vlc_t *)user, FALSE, code, bits, entry);
+}
+
 void plm_video_destroy(plm_video_t *self) {
+	plm_video_set_slice_threads(self, 1);
+	plm_video_set_retained_frames(self, 0);
+
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
@@ -2733,6 +4613,10 @@ void plm_video_destroy(plm_video_t *self) {
 		PLM_FREE(self->frames_data);
 	}
 
+	if (self->thumbnail_data) {
+		PLM_FREE(self->thumbnail_data);
+	}
+
 	PLM_FREE(self);
 }
 
@@ -2758,6 +4642,186 @@ void plm_video_set_no_delay(plm_video_t *self, int no_delay) {
 	self->assume_no_b_frames = no_delay;
 }
 
+void plm_video_set_slice_threads(plm_video_t *self, int threads) {
+	plm_video_slice_pool_t *pool = self->slice_pool;
+	if (pool) {
+		mutex_lock(&pool->lock);
+		pool->stop = TRUE;
+		cond_broadcast(&pool->cond);
+		mutex_unlock(&pool->lock);
+
+		for (int i = 0; i < pool->thread_count; i++) {
+			if (pool->workers[i].thread) {
+				thd_join(pool->workers[i].thread, NULL);
+			}
+			PLM_FREE(pool->workers[i].context);
+		}
+		cond_destroy(&pool->done);
+		cond_destroy(&pool->cond);
+		mutex_destroy(&pool->lock);
+		PLM_FREE(pool->workers);
+		PLM_FREE(pool->slices);
+		PLM_FREE(pool->scan);
+		PLM_FREE(pool);
+		self->slice_pool = NULL;
+	}
+
+	if (threads <= 1) {
+		return;
+	}
+
+	pool = (plm_video_slice_pool_t *)PLM_MALLOC(sizeof(plm_video_slice_pool_t));
+	memset(pool, 0, sizeof(plm_video_slice_pool_t));
+	mutex_init(&pool->lock, MUTEX_TYPE_NORMAL);
+	cond_init(&pool->cond);
+	cond_init(&pool->done);
+	pool->thread_count = threads;
+	pool->slice_capacity = 64;
+	pool->slices = (plm_video_slice_t *)PLM_MALLOC(
+		pool->slice_capacity * sizeof(plm_video_slice_t)
+	);
+	pool->scan_capacity = 64;
+	pool->scan = (plm_video_slice_t *)PLM_MALLOC(
+		pool->scan_capacity * sizeof(plm_video_slice_t)
+	);
+	pool->workers = (plm_video_slice_worker_t *)PLM_MALLOC(
+		threads * sizeof(plm_video_slice_worker_t)
+	);
+	memset(pool->workers, 0, threads * sizeof(plm_video_slice_worker_t));
+
+	// Worker 0 is the decoding thread itself
+	for (int i = 0; i < threads; i++) {
+		plm_video_slice_worker_t *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->context = (plm_video_t *)PLM_MALLOC(sizeof(plm_video_t));
+		memset(worker->context, 0, sizeof(plm_video_t));
+		worker->context->quant_table_scale[0] = -1;
+		worker->context->quant_table_scale[1] = -1;
+		if (i > 0) {
+			worker->thread = thd_create(0, plm_video_slice_thread, worker);
+		}
+	}
+	self->slice_pool = pool;
+}
+
+void plm_video_set_retained_frames(plm_video_t *self, int count) {
+	plm_video_frame_pool_t *pool = self->frame_pool;
+	if (pool) {
+		// The first 3 outputs are the display buffers the frames came with.
+		// Move the frames that currently use an allocated one back into a
+		// free one of those, so that the reference frames stay intact.
+		if (pool->outputs) {
+			plm_frame_t *frames[3] = {
+				&self->frame_current, &self->frame_forward, &self->frame_backward
+			};
+			for (int i = 0; i < 3; i++) {
+				uint32_t *display = frames[i]->display;
+				if (
+					display == pool->outputs[0].display ||
+					display == pool->outputs[1].display ||
+					display == pool->outputs[2].display
+				) {
+					continue;
+				}
+				for (int j = 0; j < 3; j++) {
+					uint32_t *free_display = pool->outputs[j].display;
+					if (
+						frames[0]->display != free_display &&
+						frames[1]->display != free_display &&
+						frames[2]->display != free_display
+					) {
+						memcpy(free_display, display, plm_video_display_size(self));
+						frames[i]->display = free_display;
+						break;
+					}
+				}
+			}
+			PLM_FREE(pool->outputs);
+			PLM_FREE(pool->data);
+		}
+		mutex_destroy(&pool->lock);
+		PLM_FREE(pool);
+		self->frame_pool = NULL;
+	}
+
+	if (count <= 0) {
+		return;
+	}
+
+	// The display buffers are allocated with the first picture, when the
+	// frame size is known
+	pool = (plm_video_frame_pool_t *)PLM_MALLOC(sizeof(plm_video_frame_pool_t));
+	memset(pool, 0, sizeof(plm_video_frame_pool_t));
+	mutex_init(&pool->lock, MUTEX_TYPE_NORMAL);
+	pool->retained = count;
+	self->frame_pool = pool;
+}
+
+void plm_video_release_frame(plm_video_t *self, plm_frame_t *frame) {
+	plm_video_frame_pool_t *pool = self->frame_pool;
+	if (!pool || !frame) {
+		return;
+	}
+
+	mutex_lock(&pool->lock);
+	for (int i = 0; i < pool->output_count; i++) {
+		if (&pool->outputs[i].frame == frame) {
+			pool->outputs[i].held = FALSE;
+			break;
+		}
+	}
+	mutex_unlock(&pool->lock);
+}
+
+void plm_video_set_drop_policy(plm_video_t *self, int policy) {
+	self->drop_policy = policy;
+}
+
+void plm_video_set_deadline(plm_video_t *self, double time, double tolerance) {
+	self->drop_deadline = time;
+	self->drop_tolerance = tolerance;
+}
+
+int plm_video_get_dropped_frames(plm_video_t *self, int picture_type) {
+	if (picture_type < 0 || picture_type > PLM_VIDEO_PICTURE_TYPE_B) {
+		return 0;
+	}
+	if (picture_type == 0) {
+		return
+			self->dropped_frames[PLM_VIDEO_PICTURE_TYPE_INTRA] +
+			self->dropped_frames[PLM_VIDEO_PICTURE_TYPE_PREDICTIVE] +
+			self->dropped_frames[PLM_VIDEO_PICTURE_TYPE_B];
+	}
+	return self->dropped_frames[picture_type];
+}
+
+void plm_video_set_scale(plm_video_t *self, int scale) {
+	int shift = scale >= 4 ? 2 : (scale >= 2 ? 1 : 0);
+	if (shift == self->scale_shift) {
+		return;
+	}
+
+	if (!self->has_sequence_header) {
+		self->scale_shift = shift;
+		return;
+	}
+
+	// Reallocate the frames at the new size; the display buffers of the pool
+	// have to go first, while they still have the old one
+	int retained = self->frame_pool ? self->frame_pool->retained : 0;
+	plm_video_set_retained_frames(self, 0);
+	PLM_FREE(self->frames_data);
+
+	self->scale_shift = shift;
+	plm_video_init_frames(self);
+	plm_video_set_retained_frames(self, retained);
+
+	// The new reference frames are blank, so nothing can be predicted from
+	// them before the next I-picture
+	self->has_reference_frame = FALSE;
+	self->broken_references = 2;
+}
+
 double plm_video_get_time(plm_video_t *self) {
 	return self->time;
 }
@@ -2772,6 +4836,9 @@ void plm_video_rewind(plm_video_t *self) {
 	self->time = 0;
 	self->frames_decoded = 0;
 	self->has_reference_frame = FALSE;
+	self->broken_references = 0;
+	self->reference_dropped = FALSE;
+	self->frames_dropped_pending = 0;
 	self->start_code = -1;
 }
 
@@ -2821,9 +4888,15 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 			return NULL;
 		}
 		plm_buffer_discard_read_bytes(self->buffer);
-		plm_video_decode_picture(self);
+		if (!plm_video_decode_picture(self)) {
+			continue;
+		}
 
-		if (self->assume_no_b_frames) {
+		if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+			// D-pictures are never used as reference, nor mixed with others
+			frame = &self->frame_current;
+		}
+		else if (self->assume_no_b_frames) {
 			frame = &self->frame_backward;
 		}
 		else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
@@ -2839,11 +4912,114 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 
 	frame->time = self->time;
 	self->frames_decoded++;
+
+	// Reference pictures dropped since the last decoded one would have been
+	// shown after this frame
+	self->frames_decoded += self->frames_dropped_pending;
+	self->frames_dropped_pending = 0;
 	self->time = (double)self->frames_decoded / self->framerate;
 
+	if (self->frame_pool) {
+		frame = plm_video_frame_pool_retain(self, frame);
+	}
 	return frame;
 }
 
+plm_frame_t *plm_video_decode_thumbnail(plm_video_t *self) {
+	if (!plm_video_has_header(self)) {
+		return NULL;
+	}
+
+	// Skip to the next I- or D-picture. Only the picture type is read from
+	// the others; they still advance the time.
+	int temporal_reference;
+	while (TRUE) {
+		if (self->start_code != PLM_START_PICTURE) {
+			self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_PICTURE);
+			if (self->start_code == -1) {
+				return NULL;
+			}
+		}
+		plm_buffer_discard_read_bytes(self->buffer);
+
+		if (!plm_buffer_has(self->buffer, 13)) {
+			return NULL;
+		}
+		temporal_reference = plm_buffer_read(self->buffer, 10);
+		int type = plm_buffer_read(self->buffer, 3);
+		if (type == PLM_VIDEO_PICTURE_TYPE_INTRA || type == PLM_VIDEO_PICTURE_TYPE_D) {
+			self->picture_type = type;
+			self->buffer->bit_index -= 13;
+			break;
+		}
+
+		self->start_code = -1;
+		self->frames_decoded++;
+		self->time = (double)self->frames_decoded / self->framerate;
+	}
+
+	// The whole picture has to be in the buffer, see plm_video_decode()
+	if (
+		plm_buffer_has_start_code(self->buffer, PLM_START_PICTURE) == -1 &&
+		!plm_buffer_has_ended(self->buffer)
+	) {
+		return NULL;
+	}
+	plm_buffer_skip(self->buffer, 10 + 3 + 16); // picture header
+
+	if (!self->thumbnail_data) {
+		plm_video_init_thumbnail(self);
+	}
+
+	// Find first slice start code; skip extension and user data
+	do {
+		self->start_code = plm_buffer_next_start_code(self->buffer);
+	} while (
+		self->start_code == PLM_START_EXTENSION ||
+		self->start_code == PLM_START_USER_DATA
+	);
+
+	while (PLM_START_IS_SLICE(self->start_code)) {
+		plm_video_decode_thumbnail_slice(self, self->start_code & 0x000000FF);
+		self->start_code = plm_buffer_next_start_code(self->buffer);
+	}
+
+	// The reference frames missed all pictures up to here
+	self->has_reference_frame = FALSE;
+	self->broken_references = 2;
+
+	// The time counts the pictures in stream order. The I-picture opens its
+	// group of pictures there, but is shown after the ones it precedes in
+	// display order.
+	self->thumbnail.time = self->time + temporal_reference / self->framerate;
+	self->frames_decoded++;
+	self->time = (double)self->frames_decoded / self->framerate;
+	return &self->thumbnail;
+}
+
+void plm_video_init_thumbnail(plm_video_t *self) {
+	int mb_width = (self->mb_width + 7) >> 3;
+	int mb_height = (self->mb_height + 7) >> 3;
+	size_t size = mb_width * mb_height * 384;
+
+	// 32byte align
+	self->thumbnail_data = (uint8_t *)PLM_MALLOC(size + 31);
+	uint8_t *data = (uint8_t *)(((uintptr_t)self->thumbnail_data + 31) & ~(uintptr_t)31);
+	memset(data, 0, size);
+
+	plm_frame_t *frame = &self->thumbnail;
+	memset(frame, 0, sizeof(plm_frame_t));
+	frame->width = (self->width + 7) >> 3;
+	frame->height = (self->height + 7) >> 3;
+	frame->y.width = mb_width << 4;
+	frame->y.height = mb_height << 4;
+	frame->cr.width = mb_width << 3;
+	frame->cr.height = mb_height << 3;
+	frame->cb.width = mb_width << 3;
+	frame->cb.height = mb_height << 3;
+	frame->display = (uint32_t *)data;
+}
+
 int plm_video_has_header(plm_video_t *self) {
 	if (self->has_sequence_header) {
 		return TRUE;
@@ -2905,63 +5081,80 @@ int plm_video_decode_sequence_header(plm_video_t *self) {
 	else {
 		memcpy(self->non_intra_quant_matrix, PLM_VIDEO_NON_INTRA_QUANT_MATRIX, 64);
 	}
+	self->quant_table_scale[0] = -1;
+	self->quant_table_scale[1] = -1;
 
 	self->mb_width = (self->width + 15) >> 4;
 	self->mb_height = (self->height + 15) >> 4;
 	self->mb_size = self->mb_width * self->mb_height;
+	plm_video_init_frames(self);
 
-	self->luma_width = self->mb_width << 4;
-	self->luma_height = self->mb_height << 4;
+	self->has_sequence_header = TRUE;
+	return TRUE;
+}
+
+void plm_video_init_frames(plm_video_t *self) {
+	// The display macroblocks at the current scale
+	int shift = self->scale_shift;
+	int mask = (1 << shift) - 1;
+	self->display_mb_width = (self->mb_width + mask) >> shift;
+	self->display_mb_height = (self->mb_height + mask) >> shift;
+	self->display_mb_size = self->display_mb_width * self->display_mb_height;
 
-	self->chroma_width = self->mb_width << 3;
-	self->chroma_height = self->mb_height << 3;
+	self->luma_width = self->display_mb_width << 4;
+	self->luma_height = self->display_mb_height << 4;
 
+	self->chroma_width = self->display_mb_width << 3;
+	self->chroma_height = self->display_mb_height << 3;
 
-	// Allocate one big chunk of data for all 3 frames = 9 planes
-	size_t luma_plane_size = self->luma_width * self->luma_height;
-	size_t chroma_plane_size = self->chroma_width * self->chroma_height;
-	size_t frame_data_size = (luma_plane_size + 2 * chroma_plane_size);
+	// Allocate one big chunk of data for all 3 frames. Motion compensation
+	// reads the macroblock ordered display data of the reference frames, so
+	// there are no separate planes.
+	size_t frame_data_size = plm_video_display_size(self);
 
 	// 32byte align
-	self->frames_data = (uint8_t*)PLM_MALLOC(frame_data_size * 3 * 2 + 31);
-	uint8_t *frames_data = (uint8_t*)(((unsigned int)self->frames_data + 31) & 0xffffffe0);
+	self->frames_data = (uint8_t*)PLM_MALLOC(frame_data_size * 3 + 31);
+	uint8_t *frames_data = (uint8_t*)(((uintptr_t)self->frames_data + 31) & ~(uintptr_t)31);
+	memset(frames_data, 0, frame_data_size * 3);
 	plm_video_init_frame(self, &self->frame_current, frames_data + frame_data_size * 0);
-	plm_video_init_frame(self, &self->frame_forward, frames_data + frame_data_size * 2);
-	plm_video_init_frame(self, &self->frame_backward, frames_data + frame_data_size * 4);
-
-	self->has_sequence_header = TRUE;
-	return TRUE;
+	plm_video_init_frame(self, &self->frame_forward, frames_data + frame_data_size * 1);
+	plm_video_init_frame(self, &self->frame_backward, frames_data + frame_data_size * 2);
 }
 
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base) {
-	size_t luma_plane_size = self->luma_width * self->luma_height;
-	size_t chroma_plane_size = self->chroma_width * self->chroma_height;
-
-	frame->width = self->width;
-	frame->height = self->height;
+	int mask = (1 << self->scale_shift) - 1;
+	frame->width = (self->width + mask) >> self->scale_shift;
+	frame->height = (self->height + mask) >> self->scale_shift;
 	frame->y.width = self->luma_width;
 	frame->y.height = self->luma_height;
-	frame->y.data = base;
+	frame->y.data = NULL;
 
 	frame->cr.width = self->chroma_width;
 	frame->cr.height = self->chroma_height;
-	frame->cr.data = base + luma_plane_size;
+	frame->cr.data = NULL;
 
 	frame->cb.width = self->chroma_width;
 	frame->cb.height = self->chroma_height;
-	frame->cb.data = base + luma_plane_size + chroma_plane_size;
+	frame->cb.data = NULL;
 
-	frame->display = (uint32_t *)(base + luma_plane_size + chroma_plane_size * 2);
+	frame->display = (uint32_t *)base;
 }
 
-void plm_video_decode_picture(plm_video_t *self) {
+int plm_video_decode_picture(plm_video_t *self) {
 	plm_buffer_skip(self->buffer, 10); // skip temporalReference
 	self->picture_type = plm_buffer_read(self->buffer, 3);
 	plm_buffer_skip(self->buffer, 16); // skip vbv_delay
 
-	// D frames or unknown coding type
-	if (self->picture_type <= 0 || self->picture_type > PLM_VIDEO_PICTURE_TYPE_B) {
-		return;
+	// Unknown coding type
+	if (self->picture_type <= 0 || self->picture_type > PLM_VIDEO_PICTURE_TYPE_D) {
+		self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_PICTURE);
+		return FALSE;
+	}
+
+	// Skip the picture without decoding any slices
+	if (plm_video_drop_picture(self)) {
+		self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_PICTURE);
+		return FALSE;
 	}
 
 	// Forward full_px, f_code
@@ -2973,7 +5166,7 @@ void plm_video_decode_picture(plm_video_t *self) {
 		int f_code = plm_buffer_read(self->buffer, 3);
 		if (f_code == 0) {
 			// Ignore picture with zero f_code
-			return;
+			return TRUE;
 		}
 		self->motion_forward.r_size = f_code - 1;
 	}
@@ -2984,11 +5177,17 @@ void plm_video_decode_picture(plm_video_t *self) {
 		int f_code = plm_buffer_read(self->buffer, 3);
 		if (f_code == 0) {
 			// Ignore picture with zero f_code
-			return;
+			return TRUE;
 		}
 		self->motion_backward.r_size = f_code - 1;
 	}
 
+	// Decode into a display buffer that is neither referenced nor held
+	if (self->frame_pool) {
+		plm_video_frame_pool_acquire(self);
+	}
+	self->picture_serial++;
+
 	plm_frame_t frame_temp = self->frame_forward;
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
@@ -3007,92 +5206,19 @@ void plm_video_decode_picture(plm_video_t *self) {
 	);
 
 	// Decode all slices
-	while (PLM_START_IS_SLICE(self->start_code)) {
-		plm_video_decode_slice(self, self->start_code & 0x000000FF);
-		if (self->macroblock_address >= self->mb_size - 2) {
-			break;
+	if (self->slice_pool) {
+		plm_video_decode_slices_threaded(self);
+	}
+	else {
+		while (PLM_START_IS_SLICE(self->start_code)) {
+			plm_video_decode_slice(self, self->start_code & 0x000000FF);
+			if (self->macroblock_address >= self->mb_size - 2) {
+				break;
+			}
+			self->start_code = plm_buffer_next_start_code(self->buffer);
 		}
-		self->start_code = plm_buffer_next_start_code(self->buffer);
 	}
 
-	// Set reference frames
-	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
-		self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE)
-	{
-		uint32_t *d_y = (uint32_t *)self->frame_current.y.data;
-		uint32_t *d_cr = (uint32_t *)self->frame_current.cr.data;
-		uint32_t *d_cb = (uint32_t *)self->frame_current.cb.data;
-		uint32_t *s = self->frame_current.display;
-		int scan = (self->mb_col + 1) * 4;
-		int scan_half = scan >> 1;
-		int i;
-
-		__asm__("pref @%0" : : "r"(s));
-
-		for (i = (self->mb_row + 1); i; i--)
-		{
-			int j;
-
-			for (j = (self->mb_col + 1); j; j--)
-			{
-				int y;
-
-				__asm__("pref @%0" : : "r"(s + 16));
-
-				for (y = 0; y < 8; y++)
-				{
-					d_cb[0] = s[0];
-					d_cb[1] = s[1];
-					d_cr[0] = s[16];
-					d_cr[1] = s[17];
-					d_cb += scan_half;
-					d_cr += scan_half;
-					s += 2;
-				}
-
-				d_cb -= scan_half * 8 - 2;
-				d_cr -= scan_half * 8 - 2;
-				s += 16;
-
-				__asm__("pref @%0" : : "r"(s + 16));
-
-				for (y = 0; y < 8; y++)
-				{
-					d_y[0] = s[0];
-					d_y[1] = s[1];
-					d_y[2] = s[16];
-					d_y[3] = s[17];
-					d_y += scan;
-					s += 2;
-				}
-	
-				s += 16;
-
-				__asm__("pref @%0" : : "r"(s + 16));
-
-				for (y = 0; y < 8; y++)
-				{
-					d_y[0] = s[0];
-					d_y[1] = s[1];
-					d_y[2] = s[16];
-					d_y[3] = s[17];
-					d_y += scan;
-					s += 2;
-				}
-
-				d_y -= scan * 16 - 4;
-				s += 16;
-
-				__asm__("pref @%0" : : "r"(s + 16));
-			}
-			
-			d_cb += scan_half * 7;
-			d_cr += scan_half * 7;
-			d_y += scan * 15;
-		}
-	}
-	
-
 	// If this is a reference picture rotate the prediction pointers
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
@@ -3100,7 +5226,68 @@ void plm_video_decode_picture(plm_video_t *self) {
 	) {
 		self->frame_backward = self->frame_current;
 		self->frame_current = frame_temp;
+
+		// A skipped reference picture leaves both prediction frames broken;
+		// each decoded reference picture replaces one of them
+		if (self->broken_references) {
+			self->broken_references--;
+		}
+		self->reference_dropped = FALSE;
+	}
+	return TRUE;
+}
+
+int plm_video_drop_picture(plm_video_t *self) {
+	int type = self->picture_type;
+	int drop = FALSE;
+
+	if (type == PLM_VIDEO_PICTURE_TYPE_D) {
+		// Cheap enough to always decode
+		return FALSE;
+	}
+	else if (type == PLM_VIDEO_PICTURE_TYPE_INTRA) {
+		if (self->drop_policy == PLM_VIDEO_DROP_UNTIL_INTRA) {
+			self->drop_policy = PLM_VIDEO_DROP_NONE;
+		}
+		return FALSE;
+	}
+	else if (type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		// A P-picture predicts from the last reference picture
+		drop =
+			self->drop_policy == PLM_VIDEO_DROP_UNTIL_INTRA ||
+			self->broken_references == 2;
 	}
+	else {
+		// A B-picture predicts from the last two reference pictures
+		drop =
+			self->drop_policy == PLM_VIDEO_DROP_B ||
+			self->drop_policy == PLM_VIDEO_DROP_UNTIL_INTRA ||
+			self->broken_references > 0 || (
+				self->drop_policy == PLM_VIDEO_DROP_LATE &&
+				self->time < self->drop_deadline - self->drop_tolerance
+			);
+	}
+
+	if (!drop) {
+		return FALSE;
+	}
+	self->dropped_frames[type]++;
+
+	// A skipped B-picture would have been shown before the reference picture
+	// waiting to be returned, unless that is itself behind a skipped one.
+	// Skipped reference pictures are shown after it.
+	if (type == PLM_VIDEO_PICTURE_TYPE_B && !self->reference_dropped) {
+		self->frames_decoded++;
+		self->time = (double)self->frames_decoded / self->framerate;
+	}
+	else {
+		self->frames_dropped_pending++;
+	}
+	if (type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		self->broken_references = 2;
+		self->reference_dropped = TRUE;
+	}
+	return TRUE;
 }
 
 void plm_video_decode_slice(plm_video_t *self, int slice) {
@@ -3121,27 +5308,280 @@ void plm_video_decode_slice(plm_video_t *self, int slice) {
 		plm_buffer_skip(self->buffer, 8);
 	}
 
-	do {
-		plm_video_decode_macroblock(self);
-	} while (
-		self->macroblock_address < self->mb_size - 1 &&
-		plm_buffer_peek_non_zero(self->buffer, 23)
-	);
+	// Each picture type has its own macroblock loop, see
+	// plm_video_decode_macroblock_of()
+	switch (self->picture_type) {
+		case PLM_VIDEO_PICTURE_TYPE_INTRA:
+			plm_video_decode_macroblocks_intra(self);
+			break;
+		case PLM_VIDEO_PICTURE_TYPE_PREDICTIVE:
+			plm_video_decode_macroblocks_predictive(self);
+			break;
+		case PLM_VIDEO_PICTURE_TYPE_B:
+			plm_video_decode_macroblocks_b(self);
+			break;
+		case PLM_VIDEO_PICTURE_TYPE_D:
+			plm_video_decode_macroblocks_d(self);
+			break;
+	}
 }
 
-void plm_video_decode_macroblock(plm_video_t *self) {
+void plm_video_decode_slices_threaded(plm_video_t *self) {
+	plm_video_slice_pool_t *pool = self->slice_pool;
+
+	// Collect the slice start codes of the picture. decode() made sure that
+	// the whole picture is in the buffer, so a copy without the load callback
+	// can scan it without the underlying data moving.
+	plm_buffer_t scan = *self->buffer;
+	scan.load_callback = NULL;
+	int scan_count = 0;
+	while (PLM_START_IS_SLICE(self->start_code)) {
+		if (scan_count == pool->scan_capacity) {
+			pool->scan_capacity *= 2;
+			pool->scan = (plm_video_slice_t *)PLM_REALLOC(
+				pool->scan, pool->scan_capacity * sizeof(plm_video_slice_t)
+			);
+		}
+		pool->scan[scan_count].bit_index = scan.bit_index;
+		pool->scan[scan_count].slice = self->start_code & 0x000000FF;
+		scan_count++;
+		self->start_code = plm_buffer_next_start_code(&scan);
+	}
+	self->buffer->bit_index = scan.bit_index;
+
+	if (scan_count == 0) {
+		return;
+	}
+
+	// A thread that woke up late for the previous picture may still be
+	// looking for a slice. Wait until it has left before the contexts are
+	// replaced; one that arrives later finds no slice left to take.
+	mutex_lock(&pool->lock);
+	while (pool->active) {
+		cond_wait(&pool->done, &pool->lock);
+	}
+	mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->thread_count; i++) {
+		plm_video_slice_worker_t *worker = &pool->workers[i];
+		worker->buffer = scan;
+		worker->context->buffer = &worker->buffer;
+		plm_video_init_slice_context(worker->context, self);
+	}
+
+	// Publish the scanned list; the previous one becomes the next scan list
+	mutex_lock(&pool->lock);
+	plm_video_slice_t *slices = pool->slices;
+	int slice_capacity = pool->slice_capacity;
+	pool->slices = pool->scan;
+	pool->slice_capacity = pool->scan_capacity;
+	pool->scan = slices;
+	pool->scan_capacity = slice_capacity;
+	pool->slice_count = scan_count;
+	pool->next_slice = 0;
+	pool->slices_done = 0;
+	pool->generation++;
+	cond_broadcast(&pool->cond);
+	mutex_unlock(&pool->lock);
+
+	plm_video_slice_work(&pool->workers[0]);
+
+	mutex_lock(&pool->lock);
+	while (pool->slices_done < pool->slice_count) {
+		cond_wait(&pool->done, &pool->lock);
+	}
+	mutex_unlock(&pool->lock);
+
+	// The reference frame update needs the last decoded macroblock
+	int last = -1;
+	for (int i = 0; i < pool->thread_count; i++) {
+		if (pool->workers[i].context->macroblock_address > last) {
+			last = pool->workers[i].context->macroblock_address;
+		}
+	}
+	if (last >= 0) {
+		self->macroblock_address = last;
+		self->mb_row = last / self->mb_width;
+		self->mb_col = last % self->mb_width;
+	}
+}
+
+// Copy what plm_video_decode_slice() reads into a context: the sequence and
+// picture state. Everything a slice sets up itself is left alone. The quant
+// tables are caches of plm_video_quant_table() and only dropped when the
+// matrices changed.
+
+void plm_video_init_slice_context(plm_video_t *context, plm_video_t *self) {
+	context->mb_width = self->mb_width;
+	context->mb_height = self->mb_height;
+	context->mb_size = self->mb_size;
+	context->scale_shift = self->scale_shift;
+	context->display_mb_width = self->display_mb_width;
+	context->display_mb_size = self->display_mb_size;
+
+	context->picture_type = self->picture_type;
+	context->picture_serial = self->picture_serial;
+	context->motion_forward = self->motion_forward;
+	context->motion_backward = self->motion_backward;
+	context->frame_current = self->frame_current;
+	context->frame_forward = self->frame_forward;
+	context->frame_backward = self->frame_backward;
+	context->macroblock_address = -1;
+
+	if (memcmp(context->non_intra_quant_matrix, self->non_intra_quant_matrix, 64) != 0) {
+		memcpy(context->non_intra_quant_matrix, self->non_intra_quant_matrix, 64);
+		context->quant_table_scale[0] = -1;
+	}
+	if (memcmp(context->intra_quant_matrix, self->intra_quant_matrix, 64) != 0) {
+		memcpy(context->intra_quant_matrix, self->intra_quant_matrix, 64);
+		context->quant_table_scale[1] = -1;
+	}
+}
+
+void *plm_video_slice_thread(void *user) {
+	plm_video_slice_worker_t *worker = (plm_video_slice_worker_t *)user;
+	plm_video_slice_pool_t *pool = worker->pool;
+	int generation = 0;
+
+	mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		if (generation == pool->generation) {
+			cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		generation = pool->generation;
+
+		mutex_unlock(&pool->lock);
+		plm_video_slice_work(worker);
+		mutex_lock(&pool->lock);
+	}
+	mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void plm_video_slice_work(plm_video_slice_worker_t *worker) {
+	plm_video_slice_pool_t *pool = worker->pool;
+	plm_video_t *context = worker->context;
+
+	mutex_lock(&pool->lock);
+	pool->active++;
+	while (pool->next_slice < pool->slice_count) {
+		plm_video_slice_t slice = pool->slices[pool->next_slice++];
+		mutex_unlock(&pool->lock);
+
+		context->buffer->bit_index = slice.bit_index;
+		plm_video_decode_slice(context, slice.slice);
+
+		mutex_lock(&pool->lock);
+		pool->slices_done++;
+		if (pool->slices_done == pool->slice_count) {
+			cond_broadcast(&pool->done);
+		}
+	}
+	pool->active--;
+	if (!pool->active) {
+		cond_broadcast(&pool->done);
+	}
+	mutex_unlock(&pool->lock);
+}
+
+void plm_video_frame_pool_acquire(plm_video_t *self) {
+	plm_video_frame_pool_t *pool = self->frame_pool;
+	size_t display_size = plm_video_display_size(self);
+
+	if (!pool->outputs) {
+		pool->output_count = pool->retained + 3;
+		pool->outputs = (plm_video_output_t *)PLM_MALLOC(
+			pool->output_count * sizeof(plm_video_output_t)
+		);
+		memset(pool->outputs, 0, pool->output_count * sizeof(plm_video_output_t));
+
+		// 32byte align
+		pool->data = (uint8_t *)PLM_MALLOC(display_size * pool->retained + 31);
+		uint8_t *data = (uint8_t *)(((uintptr_t)pool->data + 31) & ~(uintptr_t)31);
+		memset(data, 0, display_size * pool->retained);
+
+		pool->outputs[0].display = self->frame_current.display;
+		pool->outputs[1].display = self->frame_forward.display;
+		pool->outputs[2].display = self->frame_backward.display;
+		for (int i = 3; i < pool->output_count; i++) {
+			pool->outputs[i].display = (uint32_t *)(data + display_size * (i - 3));
+		}
+	}
+
+	mutex_lock(&pool->lock);
+	plm_video_output_t *output = NULL;
+	for (int i = 0; i < pool->output_count; i++) {
+		plm_video_output_t *candidate = &pool->outputs[i];
+		if (
+			candidate->display == self->frame_forward.display ||
+			candidate->display == self->frame_backward.display
+		) {
+			continue;
+		}
+		if (!candidate->held) {
+			output = candidate;
+			break;
+		}
+
+		// The caller holds more frames than it asked for; reuse the oldest
+		if (!output || candidate->frame.time < output->frame.time) {
+			output = candidate;
+		}
+	}
+	output->held = FALSE;
+	mutex_unlock(&pool->lock);
+
+	self->frame_current.display = output->display;
+}
+
+plm_frame_t *plm_video_frame_pool_retain(plm_video_t *self, plm_frame_t *frame) {
+	plm_video_frame_pool_t *pool = self->frame_pool;
+	if (!pool->outputs) {
+		return frame;
+	}
+
+	mutex_lock(&pool->lock);
+	for (int i = 0; i < pool->output_count; i++) {
+		plm_video_output_t *output = &pool->outputs[i];
+		if (output->display == frame->display) {
+			output->frame = *frame;
+			output->held = TRUE;
+			frame = &output->frame;
+			break;
+		}
+	}
+	mutex_unlock(&pool->lock);
+	return frame;
+}
+
+// Decode one macroblock. This is instantiated for each picture type below,
+// so that the checks of the picture type are resolved at compile time, and
+// hands the blocks to the writers for intra or non-intra, luma or chroma
+// blocks.
+
+static inline __attribute__((always_inline)) void plm_video_decode_macroblock_of(plm_video_t *self, int picture_type) {
 	// Decode increment
 	int increment = 0;
-	int t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+	int t = plm_buffer_read_vlc_lut(
+		self->buffer, plm_video_vlc_luts.macroblock_address_increment,
+		PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+	);
 
 	while (t == 34) {
 		// macroblock_stuffing
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc_lut(
+			self->buffer, plm_video_vlc_luts.macroblock_address_increment,
+			PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+		);
 	}
 	while (t == 35) {
 		// macroblock_escape
 		increment += 33;
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc_lut(
+			self->buffer, plm_video_vlc_luts.macroblock_address_increment,
+			PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+		);
 	}
 	increment += t;
 
@@ -3163,34 +5603,42 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 			self->dc_predictor[2] = 128;
 
 			// Skipped macroblocks in P-pictures reset motion vectors
-			if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+			if (picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
 				self->motion_forward.h = 0;
 				self->motion_forward.v = 0;
 			}
 		}
 
 		// Predict skipped macroblocks
-		while (increment > 1) {
-			self->macroblock_address++;
-			self->mb_row = self->macroblock_address / self->mb_width;
-			self->mb_col = self->macroblock_address % self->mb_width;
-
-			if(self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE)
-			{
-				// Skipped macroblocks in P-pictures
-				uint32_t *dest = self->frame_current.display + self->macroblock_address * 96;
-				uint32_t *src = self->frame_forward.display + self->macroblock_address * 96;
-				for(int i = 0; i < 96; i++)
-				{
-					*dest++ = *src++;
-				}
+		if (picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+			// Skipped macroblocks in P-pictures are copies of the forward
+			// reference; the whole run is copied at once
+			if (increment > 1) {
+				plm_video_copy_skipped(
+					self, &self->frame_forward,
+					self->macroblock_address + 1, increment - 1
+				);
+				self->macroblock_address += increment - 1;
 			}
-			else
-			{
-				// Skipped macroblocks in B-pictures
-				plm_video_predict_macroblock(self);
+		}
+		else {
+			// Skipped macroblocks in B-pictures
+			uint32_t *serials = plm_video_mb_serials(self, self->frame_current.display);
+			while (increment > 1) {
+				self->macroblock_address++;
+				self->mb_row = self->macroblock_address / self->mb_width;
+				self->mb_col = self->macroblock_address % self->mb_width;
+
+				plm_frame_t *reference = plm_video_skipped_reference(self);
+				if (reference) {
+					plm_video_copy_skipped(self, reference, self->macroblock_address, 1);
+				}
+				else {
+					plm_video_predict_macroblock(self);
+					serials[self->macroblock_address] = self->picture_serial;
+				}
+				increment--;
 			}
-			increment--;
 		}
 		self->macroblock_address++;
 	}
@@ -3201,12 +5649,21 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 	if (self->mb_col >= self->mb_width || self->mb_row >= self->mb_height) {
 		return; // corrupt stream;
 	}
+	plm_video_mb_serials(self, self->frame_current.display)[self->macroblock_address] =
+		self->picture_serial;
 
 	// Process the current macroblock
-	const plm_vlc_t *table = PLM_VIDEO_MACROBLOCK_TYPE[self->picture_type];
-	self->macroblock_type = plm_buffer_read_vlc(self->buffer, table);
+	self->macroblock_type = plm_buffer_read_vlc_lut(
+		self->buffer, plm_video_vlc_luts.macroblock_type[picture_type - 1],
+		PLM_VIDEO_MACROBLOCK_TYPE_LUT_BITS, PLM_VIDEO_MACROBLOCK_TYPE[picture_type]
+	);
 
-	self->macroblock_intra = (self->macroblock_type & 0x01);
+	// All macroblocks of I- and D-pictures are intra-coded
+	int intra = (
+		picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
+		picture_type == PLM_VIDEO_PICTURE_TYPE_D ||
+		(self->macroblock_type & 0x01)
+	);
 	self->motion_forward.is_set = (self->macroblock_type & 0x08);
 	self->motion_backward.is_set = (self->macroblock_type & 0x04);
 
@@ -3215,7 +5672,7 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 		self->quantizer_scale = plm_buffer_read(self->buffer, 5);
 	}
 
-	if (self->macroblock_intra) {
+	if (intra) {
 		// Intra-coded macroblocks reset motion vectors
 		self->motion_backward.h = self->motion_forward.h = 0;
 		self->motion_backward.v = self->motion_forward.v = 0;
@@ -3231,21 +5688,63 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 	}
 
 	// Decode blocks
-	int cbp = ((self->macroblock_type & 0x02) != 0)
-		? plm_buffer_read_vlc(self->buffer, PLM_VIDEO_CODE_BLOCK_PATTERN)
-		: (self->macroblock_intra ? 0x3f : 0);
-     
-	for (int block = 0, mask = 0x20; block < 6; block++) {
-		if ((cbp & mask) != 0) {
-			plm_video_decode_block(self, block);
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+		for (int block = 0; block < 4; block++) {
+			plm_video_decode_dc_luma_block(self, block);
+		}
+		plm_video_decode_dc_chroma_block(self, 4);
+		plm_video_decode_dc_chroma_block(self, 5);
+		plm_buffer_skip(self->buffer, 1); // end_of_macroblock
+	}
+	else if (intra) {
+		// Intra-coded macroblocks have all blocks coded
+		for (int block = 0; block < 4; block++) {
+			plm_video_decode_intra_luma_block(self, block);
+		}
+		plm_video_decode_intra_chroma_block(self, 4);
+		plm_video_decode_intra_chroma_block(self, 5);
+	}
+	else if ((self->macroblock_type & 0x02) != 0) {
+		int cbp = plm_buffer_read_vlc_lut(
+			self->buffer, plm_video_vlc_luts.code_block_pattern,
+			PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_BITS, PLM_VIDEO_CODE_BLOCK_PATTERN
+		);
+		for (int block = 0; block < 4; block++) {
+			if (cbp & (0x20 >> block)) {
+				plm_video_decode_non_intra_luma_block(self, block);
+			}
+		}
+		if (cbp & 0x02) {
+			plm_video_decode_non_intra_chroma_block(self, 4);
+		}
+		if (cbp & 0x01) {
+			plm_video_decode_non_intra_chroma_block(self, 5);
 		}
-		mask >>= 1;
 	}
 }
 
+#define PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION(NAME, PICTURE_TYPE) \
+	void NAME(plm_video_t *self) { \
+		do { \
+			plm_video_decode_macroblock_of(self, PICTURE_TYPE); \
+		} while ( \
+			self->macroblock_address < self->mb_size - 1 && \
+			plm_buffer_peek_non_zero(self->buffer, 23) \
+		); \
+	}
+
+PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION(plm_video_decode_macroblocks_intra, PLM_VIDEO_PICTURE_TYPE_INTRA)
+PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION(plm_video_decode_macroblocks_predictive, PLM_VIDEO_PICTURE_TYPE_PREDICTIVE)
+PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION(plm_video_decode_macroblocks_b, PLM_VIDEO_PICTURE_TYPE_B)
+PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION(plm_video_decode_macroblocks_d, PLM_VIDEO_PICTURE_TYPE_D)
+
+#undef PLM_DEFINE_DECODE_MACROBLOCKS_FUNCTION
+
 #define plm_video_decode_motion_vector(r_size, motion) do {	\
 	int fscale = 1 << r_size;	\
-	int m_code = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MOTION);	\
+	int m_code = plm_buffer_read_vlc_lut(	\
+		self->buffer, plm_video_vlc_luts.motion_code, PLM_VIDEO_MOTION_LUT_BITS, PLM_VIDEO_MOTION	\
+	);	\
 	int r = 0;	\
 	int d;	\
 	if ((m_code != 0) && (fscale != 1)) {	\
@@ -3268,6 +5767,90 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 	}	\
 } while (FALSE)
 
+void plm_video_copy_skipped(
+	plm_video_t *self, plm_frame_t *reference, int address, int count
+) {
+	uint32_t *dest = self->frame_current.display;
+	uint32_t *src = reference->display;
+	uint32_t *dest_serials = plm_video_mb_serials(self, dest);
+	uint32_t *src_serials = plm_video_mb_serials(self, src);
+	int end = address + count;
+
+	while (address < end) {
+		// Leave out macroblocks that already hold the reference data, e.g.
+		// the static parts of a scene once every display buffer has them
+		if (src_serials[address] && dest_serials[address] == src_serials[address]) {
+			address++;
+			continue;
+		}
+
+		if (self->scale_shift) {
+			// The areas of single macroblocks aren't contiguous
+			dest_serials[address] = src_serials[address];
+			plm_video_copy_reduced(self, dest, src, address);
+			address++;
+			continue;
+		}
+
+		int run_end = address;
+		do {
+			dest_serials[run_end] = src_serials[run_end];
+			run_end++;
+		} while (
+			run_end < end &&
+			!(src_serials[run_end] && dest_serials[run_end] == src_serials[run_end])
+		);
+		memcpy(dest + address * 96, src + address * 96, (run_end - address) * 384);
+		address = run_end;
+	}
+}
+
+void plm_video_copy_reduced(plm_video_t *self, uint32_t *dest, uint32_t *src, int address) {
+	uint8_t *dest_luma, *dest_chroma, *src_luma, *src_chroma;
+	plm_video_reduced_area(self, dest, address, &dest_luma, &dest_chroma);
+	plm_video_reduced_area(self, src, address, &src_luma, &src_chroma);
+
+	int size = 16 >> self->scale_shift;
+	for (int i = 0; i < size; i++) {
+		memcpy(dest_luma + i * 8, src_luma + i * 8, size);
+	}
+	size >>= 1;
+	for (int i = 0; i < size; i++) {
+		memcpy(dest_chroma + i * 8, src_chroma + i * 8, size);
+		memcpy(dest_chroma + 64 + i * 8, src_chroma + 64 + i * 8, size);
+	}
+}
+
+plm_frame_t *plm_video_skipped_reference(plm_video_t *self) {
+	// A skipped macroblock in a B-picture that isn't moved is a plain copy of
+	// its reference. Averaging two references only gives a copy if they hold
+	// the same data.
+	int forward = self->motion_forward.is_set;
+	int backward = self->motion_backward.is_set;
+	if (forward && (self->motion_forward.h || self->motion_forward.v)) {
+		return NULL;
+	}
+	if (backward && (self->motion_backward.h || self->motion_backward.v)) {
+		return NULL;
+	}
+
+	if (forward && backward) {
+		uint32_t *forward_serials = plm_video_mb_serials(self, self->frame_forward.display);
+		uint32_t *backward_serials = plm_video_mb_serials(self, self->frame_backward.display);
+		uint32_t serial = forward_serials[self->macroblock_address];
+		return serial && serial == backward_serials[self->macroblock_address]
+			? &self->frame_forward
+			: NULL;
+	}
+	if (forward) {
+		return &self->frame_forward;
+	}
+	if (backward) {
+		return &self->frame_backward;
+	}
+	return NULL;
+}
+
 void plm_video_decode_motion_vectors(plm_video_t *self) {
 
 	// Forward
@@ -3290,6 +5873,11 @@ void plm_video_decode_motion_vectors(plm_video_t *self) {
 }
 
 void plm_video_predict_macroblock(plm_video_t *self) {
+	if (self->scale_shift) {
+		plm_video_predict_reduced_macroblock(self);
+		return;
+	}
+
 	uint32_t *d = self->frame_current.display + self->macroblock_address * 96;
 	int fw_h = self->motion_forward.h;
 	int fw_v = self->motion_forward.v;
@@ -3313,9 +5901,14 @@ void plm_video_predict_macroblock(plm_video_t *self) {
 		bw_v += bw_v < 0 ? ((self->mb_row - self->mb_height) << 5) : (self->mb_row << 5);
 
 		if (self->motion_forward.is_set) {
-			plm_video_copy_macroblock(d, &self->frame_forward, fw_h, fw_v);
 			if (self->motion_backward.is_set) {
-				plm_video_interpolate_macroblock(d, &self->frame_backward, bw_h, bw_v);
+				plm_video_interpolate_macroblock(
+					d, &self->frame_forward, fw_h, fw_v,
+					&self->frame_backward, bw_h, bw_v
+				);
+			}
+			else {
+				plm_video_copy_macroblock(d, &self->frame_forward, fw_h, fw_v);
 			}
 		}
 		else {
@@ -3327,411 +5920,888 @@ void plm_video_predict_macroblock(plm_video_t *self) {
 	}
 }
 
-void plm_video_copy_macroblock(
-	uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v
+// Motion compensation kernels. Each one predicts an 8x8 block, 4 pixels per
+// 32-bit word, straight from the macroblock ordered display data of the
+// reference frame. The source area starts at pixel (x, y) of the block
+// src[0] and reaches into its neighbours src[1] to the right, src[3] below
+// and src[4] below right. A source row is read as aligned words from the two
+// blocks and shifted into place.
+// The half-pel averages are exact per byte:
+// (a | b) - (((a ^ b) & 0xfefefefe) >> 1) == (a + b + 1) >> 1, and the
+// 4-way average sums the upper 6 and the lower 2 bits of each byte separately
+// so that (a + b + c + d + 2) >> 2 never carries into the next byte.
+// There is one kernel for each (odd_h, odd_v) combination of a single
+// reference and one for each combination of two references, which averages
+// both predictions in the same pass.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	#define PLM_WORD_FUNNEL(lo, hi, bits) (((lo) << (bits)) | ((hi) >> (32 - (bits))))
+#else
+	#define PLM_WORD_FUNNEL(lo, hi, bits) (((lo) >> (bits)) | ((hi) << (32 - (bits))))
+#endif
+
+static inline __attribute__((always_inline)) void plm_video_mc_load(
+	const uint32_t *a, const uint32_t *b, int x, uint32_t *p, uint32_t *q
 ) {
-	int dw = reference->width;
-	int dh = reference->height;
-	int hp = motion_h < 0 ? (dw + (motion_h >> 1)) : (motion_h >> 1);
-	int vp = motion_v < 0 ? (dh + (motion_v >> 1)) : (motion_v >> 1);
-	int odd_h = (motion_h & 1) == 1;
-	int odd_v = (motion_v & 1) == 1;
-	uint8_t *src = reference->y.data;
-	unsigned int si = vp * dw + hp;
-
-	/* Y block */
-	dest += 32;
-	__asm__("pref @%0" : : "r"(dest));
-	
-	if (odd_h && odd_v)
-	{
-		uint8_t *d = (uint8_t *)dest;
-		uint8_t *s1 = (uint8_t *)(src + si);
-		uint8_t *s2 = (uint8_t *)(src + si + dw);
-		int scan = dw;
-		for (int i = 2; i; i--)
-		{
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
-				d[0] = (s1[0] + s1[1] + s2[0] + s2[1] + 2) >> 2;
-				d[1] = (s1[1] + s1[2] + s2[1] + s2[2] + 2) >> 2;
-				d[2] = (s1[2] + s1[3] + s2[2] + s2[3] + 2) >> 2;
-				d[3] = (s1[3] + s1[4] + s2[3] + s2[4] + 2) >> 2;
-				d[4] = (s1[4] + s1[5] + s2[4] + s2[5] + 2) >> 2;
-				d[5] = (s1[5] + s1[6] + s2[5] + s2[6] + 2) >> 2;
-				d[6] = (s1[6] + s1[7] + s2[6] + s2[7] + 2) >> 2;
-				d[7] = (s1[7] + s1[8] + s2[7] + s2[8] + 2) >> 2;
-				d[64] = (s1[8] + s1[9] + s2[8] + s2[9] + 2) >> 2;
-				d[65] = (s1[9] + s1[10] + s2[9] + s2[10] + 2) >> 2;
-				d[66] = (s1[10] + s1[11] + s2[10] + s2[11] + 2) >> 2;
-				d[67] = (s1[11] + s1[12] + s2[11] + s2[12] + 2) >> 2;
-				d[68] = (s1[12] + s1[13] + s2[12] + s2[13] + 2) >> 2;
-				d[69] = (s1[13] + s1[14] + s2[13] + s2[14] + 2) >> 2;
-				d[70] = (s1[14] + s1[15] + s2[14] + s2[15] + 2) >> 2;
-				d[71] = (s1[15] + s1[16] + s2[15] + s2[16] + 2) >> 2;
-				d += 8;
-				s1 += scan;
-				s2 += scan;
-			}
-			d += 64;
-		}
+	// Load the 8 pixels at x of the row a, b into p and, if q is given, the
+	// 8 pixels at x + 1 into q
+	uint32_t w0, w1, w2;
+	if (x & 4) {
+		w0 = a[1];
+		w1 = b[0];
+		w2 = b[1];
+	}
+	else if (x || q) {
+		w0 = a[0];
+		w1 = a[1];
+		w2 = b[0];
 	}
-	else if (odd_v)
-	{
-		uint8_t *d = (uint8_t *)dest;
-		uint8_t *s1 = (uint8_t *)(src + si);
-		uint8_t *s2 = (uint8_t *)(src + si + dw);
-		int scan = dw;
-		for (int i = 2; i; i--)
-		{
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
-				d[0] = (s1[0] + s2[0] + 1) >> 1;
-				d[1] = (s1[1] + s2[1] + 1) >> 1;
-				d[2] = (s1[2] + s2[2] + 1) >> 1;
-				d[3] = (s1[3] + s2[3] + 1) >> 1;
-				d[4] = (s1[4] + s2[4] + 1) >> 1;
-				d[5] = (s1[5] + s2[5] + 1) >> 1;
-				d[6] = (s1[6] + s2[6] + 1) >> 1;
-				d[7] = (s1[7] + s2[7] + 1) >> 1;
-				d[64] = (s1[8] + s2[8] + 1) >> 1;
-				d[65] = (s1[9] + s2[9] + 1) >> 1;
-				d[66] = (s1[10] + s2[10] + 1) >> 1;
-				d[67] = (s1[11] + s2[11] + 1) >> 1;
-				d[68] = (s1[12] + s2[12] + 1) >> 1;
-				d[69] = (s1[13] + s2[13] + 1) >> 1;
-				d[70] = (s1[14] + s2[14] + 1) >> 1;
-				d[71] = (s1[15] + s2[15] + 1) >> 1;
-				d += 8;
-				s1 += scan;
-				s2 += scan;
-			}
-			d += 64;
-		}
+	else {
+		p[0] = a[0];
+		p[1] = a[1];
+		return;
 	}
-	else if (odd_h)
-	{
-		uint8_t *d = (uint8_t *)dest;
-		uint8_t *s = (uint8_t *)(src + si);
-		int scan = dw;
-		for (int i = 2; i; i--)
-		{
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s + scan));
-				d[0] = (s[0] + s[1] + 1) >> 1;
-				d[1] = (s[1] + s[2] + 1) >> 1;
-				d[2] = (s[2] + s[3] + 1) >> 1;
-				d[3] = (s[3] + s[4] + 1) >> 1;
-				d[4] = (s[4] + s[5] + 1) >> 1;
-				d[5] = (s[5] + s[6] + 1) >> 1;
-				d[6] = (s[6] + s[7] + 1) >> 1;
-				d[7] = (s[7] + s[8] + 1) >> 1;
-				d[64] = (s[8] + s[9] + 1) >> 1;
-				d[65] = (s[9] + s[10] + 1) >> 1;
-				d[66] = (s[10] + s[11] + 1) >> 1;
-				d[67] = (s[11] + s[12] + 1) >> 1;
-				d[68] = (s[12] + s[13] + 1) >> 1;
-				d[69] = (s[13] + s[14] + 1) >> 1;
-				d[70] = (s[14] + s[15] + 1) >> 1;
-				d[71] = (s[15] + s[16] + 1) >> 1;
-				d += 8;
-				s += scan;
-			}
-			d += 64;
-		}
+
+	int bits = (x & 3) << 3;
+	if (bits) {
+		p[0] = PLM_WORD_FUNNEL(w0, w1, bits);
+		p[1] = PLM_WORD_FUNNEL(w1, w2, bits);
 	}
-	else
-	{
-		if (hp & 1)
-		{
-			uint8_t *d = (uint8_t *)dest;
-			uint8_t *s = (uint8_t *)(src + si);
-			int scan = dw;
-			for (int i = 2; i; i--)
-			{
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d[2] = s[2];
-					d[3] = s[3];
-					d[4] = s[4];
-					d[5] = s[5];
-					d[6] = s[6];
-					d[7] = s[7];
-					d[64] = s[8];
-					d[65] = s[9];
-					d[66] = s[10];
-					d[67] = s[11];
-					d[68] = s[12];
-					d[69] = s[13];
-					d[70] = s[14];
-					d[71] = s[15];
-					d += 8;
-					s += scan;
-				}
-				d += 64;
-			}
+	else {
+		p[0] = w0;
+		p[1] = w1;
+	}
+	if (q) {
+		bits += 8;
+		if (bits == 32) {
+			q[0] = w1;
+			q[1] = w2;
 		}
-		else if (hp & 2)
-		{
-			uint16_t *d = (uint16_t *)dest;
-			uint16_t *s = (uint16_t *)(src + si);
-			int scan = dw >> 1;
-			for (int i = 2; i; i--)
-			{
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d[2] = s[2];
-					d[3] = s[3];
-					d[32] = s[4];
-					d[33] = s[5];
-					d[34] = s[6];
-					d[35] = s[7];
-					d += 4;
-					s += scan;
-				}
-				d += 32;
-			}
+		else {
+			q[0] = PLM_WORD_FUNNEL(w0, w1, bits);
+			q[1] = PLM_WORD_FUNNEL(w1, w2, bits);
 		}
-		else
-		{
-			uint32_t *d = (uint32_t *)dest;
-			uint32_t *s = (uint32_t *)(src + si);
-			int scan = dw >> 2;
-			for (int i = 2; i; i--)
-			{
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d[16] = s[2];
-					d[17] = s[3];
-					d += 2;
-					s += scan;
-				}
-				d += 16;
-			}
+	}
+}
+
+static inline __attribute__((always_inline)) uint32_t plm_video_mc_avg2(uint32_t a, uint32_t b) {
+	return (a | b) - (((a ^ b) & 0xfefefefe) >> 1);
+}
+
+static inline __attribute__((always_inline)) uint32_t plm_video_mc_avg4(
+	uint32_t a, uint32_t b, uint32_t c, uint32_t d
+) {
+	uint32_t hi =
+		((a >> 2) & 0x3f3f3f3f) + ((b >> 2) & 0x3f3f3f3f) +
+		((c >> 2) & 0x3f3f3f3f) + ((d >> 2) & 0x3f3f3f3f);
+	uint32_t lo =
+		(a & 0x03030303) + (b & 0x03030303) +
+		(c & 0x03030303) + (d & 0x03030303) + 0x02020202;
+	return hi + ((lo >> 2) & 0x03030303);
+}
+
+#if defined(__SSE2__)
+
+// With SSE2 a source row is the two block rows in one register, shifted
+// right by x bytes, and the averages use pavgb and 16-bit sums. The rounding
+// is the same as with the word kernels.
+
+static inline __attribute__((always_inline)) __m128i plm_video_mc_load_sse2(
+	const uint32_t *a, const uint32_t *b, int x
+) {
+	__m128i row = _mm_unpacklo_epi64(
+		_mm_loadl_epi64((const __m128i *)a), _mm_loadl_epi64((const __m128i *)b)
+	);
+	__m128i lo = _mm_srl_epi64(row, _mm_cvtsi32_si128(x << 3));
+	__m128i hi = _mm_sll_epi64(_mm_srli_si128(row, 8), _mm_cvtsi32_si128(64 - (x << 3)));
+	return _mm_or_si128(lo, hi);
+}
+
+static inline __attribute__((always_inline)) __m128i plm_video_mc_avg4_sse2(
+	__m128i a, __m128i b, __m128i c, __m128i d
+) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_add_epi16(
+		_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+		_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero))
+	);
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+	return _mm_packus_epi16(sum, sum);
+}
+
+typedef struct {
+	const uint32_t **src;
+	const uint32_t *a;
+	const uint32_t *b;
+	int x;
+	int y;
+	__m128i p;
+	__m128i q;
+} plm_video_mc_rows_t;
+
+static inline __attribute__((always_inline)) void plm_video_mc_next_row(plm_video_mc_rows_t *r) {
+	if (++r->y == 8) {
+		r->a = r->src[3];
+		r->b = r->src[4];
+	}
+	else {
+		r->a += 2;
+		r->b += 2;
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_mc_begin(
+	plm_video_mc_rows_t *r, const uint32_t **src, int x, int y, int odd_h, int odd_v
+) {
+	r->src = src;
+	r->a = src[0] + y * 2;
+	r->b = src[1] + y * 2;
+	r->x = x;
+	r->y = y;
+	if (odd_v) {
+		r->p = plm_video_mc_load_sse2(r->a, r->b, x);
+		r->q = odd_h ? plm_video_mc_load_sse2(r->a, r->b, x + 1) : r->p;
+		plm_video_mc_next_row(r);
+	}
+	else {
+		// Not read without odd_v; only set for the kernels with a variable mode
+		r->p = r->q = _mm_setzero_si128();
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_mc_row(
+	plm_video_mc_rows_t *r, uint32_t *out, int odd_h, int odd_v
+) {
+	__m128i p = plm_video_mc_load_sse2(r->a, r->b, r->x);
+	__m128i q = odd_h ? plm_video_mc_load_sse2(r->a, r->b, r->x + 1) : p;
+	plm_video_mc_next_row(r);
+
+	__m128i o = p;
+	if (odd_h && odd_v) {
+		o = plm_video_mc_avg4_sse2(r->p, r->q, p, q);
+	}
+	else if (odd_v) {
+		o = _mm_avg_epu8(r->p, p);
+	}
+	else if (odd_h) {
+		o = _mm_avg_epu8(p, q);
+	}
+	_mm_storel_epi64((__m128i *)out, o);
+
+	if (odd_v) {
+		r->p = p;
+		r->q = q;
+	}
+}
+
+#else
+
+// The rows of one source area. With odd_v the previous row is kept in p, q.
+
+typedef struct {
+	const uint32_t **src;
+	const uint32_t *a;
+	const uint32_t *b;
+	int x;
+	int y;
+	uint32_t p[2];
+	uint32_t q[2];
+} plm_video_mc_rows_t;
+
+static inline __attribute__((always_inline)) void plm_video_mc_next_row(plm_video_mc_rows_t *r) {
+	// After the 8th row of the top blocks continue with the ones below
+	if (++r->y == 8) {
+		r->a = r->src[3];
+		r->b = r->src[4];
+	}
+	else {
+		r->a += 2;
+		r->b += 2;
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_mc_begin(
+	plm_video_mc_rows_t *r, const uint32_t **src, int x, int y, int odd_h, int odd_v
+) {
+	r->src = src;
+	r->a = src[0] + y * 2;
+	r->b = src[1] + y * 2;
+	r->x = x;
+	r->y = y;
+	if (odd_v) {
+		plm_video_mc_load(r->a, r->b, x, r->p, odd_h ? r->q : NULL);
+		plm_video_mc_next_row(r);
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_mc_row(
+	plm_video_mc_rows_t *r, uint32_t *out, int odd_h, int odd_v
+) {
+	uint32_t p[2], q[2];
+	plm_video_mc_load(r->a, r->b, r->x, p, odd_h ? q : NULL);
+	plm_video_mc_next_row(r);
+
+	if (odd_h && odd_v) {
+		out[0] = plm_video_mc_avg4(r->p[0], r->q[0], p[0], q[0]);
+		out[1] = plm_video_mc_avg4(r->p[1], r->q[1], p[1], q[1]);
+	}
+	else if (odd_v) {
+		out[0] = plm_video_mc_avg2(r->p[0], p[0]);
+		out[1] = plm_video_mc_avg2(r->p[1], p[1]);
+	}
+	else if (odd_h) {
+		out[0] = plm_video_mc_avg2(p[0], q[0]);
+		out[1] = plm_video_mc_avg2(p[1], q[1]);
+	}
+	else {
+		out[0] = p[0];
+		out[1] = p[1];
+	}
+
+	if (odd_v) {
+		r->p[0] = p[0];
+		r->p[1] = p[1];
+		if (odd_h) {
+			r->q[0] = q[0];
+			r->q[1] = q[1];
 		}
 	}
+}
+
+#endif
+
+#define PLM_DEFINE_MC_FUNCTION(NAME, ODD_H, ODD_V) \
+	void NAME(uint32_t *d, const uint32_t **src, int x, int y) { \
+		plm_video_mc_rows_t rows; \
+		plm_video_mc_begin(&rows, src, x, y, ODD_H, ODD_V); \
+		for (int j = 8; j; j--) { \
+			plm_video_mc_row(&rows, d, ODD_H, ODD_V); \
+			d += 2; \
+		} \
+	}
+
+#define PLM_DEFINE_MC_BIDIR_FUNCTION(NAME, F_ODD_H, F_ODD_V, B_ODD_H, B_ODD_V) \
+	void NAME( \
+		uint32_t *d, const uint32_t **src, int x, int y, \
+		const uint32_t **src2, int x2, int y2 \
+	) { \
+		plm_video_mc_rows_t forward, backward; \
+		uint32_t f[2], b[2]; \
+		plm_video_mc_begin(&forward, src, x, y, F_ODD_H, F_ODD_V); \
+		plm_video_mc_begin(&backward, src2, x2, y2, B_ODD_H, B_ODD_V); \
+		for (int j = 8; j; j--) { \
+			plm_video_mc_row(&forward, f, F_ODD_H, F_ODD_V); \
+			plm_video_mc_row(&backward, b, B_ODD_H, B_ODD_V); \
+			d[0] = plm_video_mc_avg2(f[0], b[0]); \
+			d[1] = plm_video_mc_avg2(f[1], b[1]); \
+			d += 2; \
+		} \
+	}
+
+PLM_DEFINE_MC_FUNCTION(plm_video_mc_copy,  0, 0)
+PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_h, 1, 0)
+PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_v, 0, 1)
+PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_hv, 1, 1)
+
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_0_0, 0, 0, 0, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_0_h, 0, 0, 1, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_0_v, 0, 0, 0, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_0_hv, 0, 0, 1, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_h_0, 1, 0, 0, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_h_h, 1, 0, 1, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_h_v, 1, 0, 0, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_h_hv, 1, 0, 1, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_v_0, 0, 1, 0, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_v_h, 0, 1, 1, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_v_v, 0, 1, 0, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_v_hv, 0, 1, 1, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_hv_0, 1, 1, 0, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_hv_h, 1, 1, 1, 0)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_hv_v, 1, 1, 0, 1)
+PLM_DEFINE_MC_BIDIR_FUNCTION(plm_video_mc_bidir_hv_hv, 1, 1, 1, 1)
+
+#undef PLM_DEFINE_MC_FUNCTION
+#undef PLM_DEFINE_MC_BIDIR_FUNCTION
+
+// Indexed by (odd_v << 1) | odd_h
+static const plm_video_mc_block_t PLM_VIDEO_MC_BLOCK[] = {
+	plm_video_mc_copy,
+	plm_video_mc_avg_h,
+	plm_video_mc_avg_v,
+	plm_video_mc_avg_hv
+};
+
+// Indexed by the forward index of PLM_VIDEO_MC_BLOCK << 2 | the backward one
+static const plm_video_mc_bidir_block_t PLM_VIDEO_MC_BIDIR_BLOCK[] = {
+	plm_video_mc_bidir_0_0,  plm_video_mc_bidir_0_h,  plm_video_mc_bidir_0_v,  plm_video_mc_bidir_0_hv,
+	plm_video_mc_bidir_h_0,  plm_video_mc_bidir_h_h,  plm_video_mc_bidir_h_v,  plm_video_mc_bidir_h_hv,
+	plm_video_mc_bidir_v_0,  plm_video_mc_bidir_v_h,  plm_video_mc_bidir_v_v,  plm_video_mc_bidir_v_hv,
+	plm_video_mc_bidir_hv_0, plm_video_mc_bidir_hv_h, plm_video_mc_bidir_hv_v, plm_video_mc_bidir_hv_hv
+};
+
+static inline int plm_video_mc_clamp(int index, int count) {
+	if (index >= count) {
+		index = count - 1;
+	}
+	else if (index < 0) {
+		index = 0;
+	}
+	return index;
+}
+
+void plm_video_mc_source(
+	plm_video_mc_source_t *source, plm_frame_t *reference, int motion_h, int motion_v
+) {
+	int dw = reference->y.width;
+	int dh = reference->y.height;
+	int hp = motion_h < 0 ? (dw + (motion_h >> 1)) : (motion_h >> 1);
+	int vp = motion_v < 0 ? (dh + (motion_v >> 1)) : (motion_v >> 1);
+	plm_video_mc_luma_source(source, reference, hp, vp);
+	source->y_mode = ((motion_v & 1) << 1) | (motion_h & 1);
 
-	/* Cb, Cr blocks */
-	dest -= 32;
-	__asm__("pref @%0" : : "r"(dest));
-	src = reference->cb.data;
 	dw >>= 1;
 	dh >>= 1;
 	motion_h /= 2;
 	motion_v /= 2;
 	hp = motion_h < 0 ? (dw + (motion_h >> 1)) : (motion_h >> 1);
 	vp = motion_v < 0 ? (dh + (motion_v >> 1)) : (motion_v >> 1);
-	odd_h = (motion_h & 1) == 1;
-	odd_v = (motion_v & 1) == 1;
-	si = vp * dw + hp;
+	plm_video_mc_chroma_source(source, reference, hp, vp);
+	source->c_mode = ((motion_v & 1) << 1) | (motion_h & 1);
+}
 
-	for (int i = 2; i; i--)
-	{
-		if (odd_h && odd_v)
-		{
-			uint8_t *d = (uint8_t *)dest;
-			uint8_t *s1 = (uint8_t *)(src + si);
-			uint8_t *s2 = (uint8_t *)(src + si + dw);
-			int scan = dw;
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
-				d[0] = (s1[0] + s1[1] + s2[0] + s2[1] + 2) >> 2;
-				d[1] = (s1[1] + s1[2] + s2[1] + s2[2] + 2) >> 2;
-				d[2] = (s1[2] + s1[3] + s2[2] + s2[3] + 2) >> 2;
-				d[3] = (s1[3] + s1[4] + s2[3] + s2[4] + 2) >> 2;
-				d[4] = (s1[4] + s1[5] + s2[4] + s2[5] + 2) >> 2;
-				d[5] = (s1[5] + s1[6] + s2[5] + s2[6] + 2) >> 2;
-				d[6] = (s1[6] + s1[7] + s2[6] + s2[7] + 2) >> 2;
-				d[7] = (s1[7] + s1[8] + s2[7] + s2[8] + 2) >> 2;
-				d += 8;
-				s1 += scan;
-				s2 += scan;
-			}
-		}
-		else if (odd_v)
-		{
-			uint8_t *d = (uint8_t *)dest;
-			uint8_t *s1 = (uint8_t *)(src + si);
-			uint8_t *s2 = (uint8_t *)(src + si + dw);
-			int scan = dw;
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
-				d[0] = (s1[0] + s2[0] + 1) >> 1;
-				d[1] = (s1[1] + s2[1] + 1) >> 1;
-				d[2] = (s1[2] + s2[2] + 1) >> 1;
-				d[3] = (s1[3] + s2[3] + 1) >> 1;
-				d[4] = (s1[4] + s2[4] + 1) >> 1;
-				d[5] = (s1[5] + s2[5] + 1) >> 1;
-				d[6] = (s1[6] + s2[6] + 1) >> 1;
-				d[7] = (s1[7] + s2[7] + 1) >> 1;
-				d += 8;
-				s1 += scan;
-				s2 += scan;
-			}
-		}
-		else if (odd_h)
-		{
-			uint8_t *d = (uint8_t *)dest;
-			uint8_t *s = (uint8_t *)(src + si);
-			int scan = dw;
-			for (int j = 8; j; j--)
-			{
-				__asm__("pref @%0" : : "r"(s + scan));
-				d[0] = (s[0] + s[1] + 1) >> 1;
-				d[1] = (s[1] + s[2] + 1) >> 1;
-				d[2] = (s[2] + s[3] + 1) >> 1;
-				d[3] = (s[3] + s[4] + 1) >> 1;
-				d[4] = (s[4] + s[5] + 1) >> 1;
-				d[5] = (s[5] + s[6] + 1) >> 1;
-				d[6] = (s[6] + s[7] + 1) >> 1;
-				d[7] = (s[7] + s[8] + 1) >> 1;
-				d += 8;
-				s += scan;
-			}
+void plm_video_mc_luma_source(
+	plm_video_mc_source_t *source, plm_frame_t *reference, int hp, int vp
+) {
+	uint32_t *display = reference->display;
+	int mb_width = reference->y.width >> 4;
+	int dw = reference->y.width;
+	int dh = reference->y.height;
+
+	// The 3x3 luma blocks covered by the source area at pixel (hp, vp). Each
+	// macroblock holds Cb, Cr and then the 4 Y blocks; the indices are
+	// clamped so that broken vectors can't read outside of the frame.
+	for (int r = 0; r < 3; r++) {
+		int by = plm_video_mc_clamp((vp >> 3) + r, dh >> 3);
+		for (int c = 0; c < 3; c++) {
+			int bx = plm_video_mc_clamp((hp >> 3) + c, dw >> 3);
+			source->y[r * 3 + c] = display +
+				((by >> 1) * mb_width + (bx >> 1)) * 96 +
+				32 + (by & 1) * 32 + (bx & 1) * 16;
 		}
-		else
-		{
-			if (hp & 1)
-			{
-				uint8_t *d = (uint8_t *)dest;
-				uint8_t *s = (uint8_t *)(src + si);
-				int scan = dw;
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d[2] = s[2];
-					d[3] = s[3];
-					d[4] = s[4];
-					d[5] = s[5];
-					d[6] = s[6];
-					d[7] = s[7];
-					d += 8;
-					s += scan;
-				}
-			}
-			else if (hp & 2)
-			{
-				uint16_t *d = (uint16_t *)dest;
-				uint16_t *s = (uint16_t *)(src + si);
-				int scan = dw >> 1;
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d[2] = s[2];
-					d[3] = s[3];
-					d += 4;
-					s += scan;
-				}
-			}
-			else
-			{
-				uint32_t *d = (uint32_t *)dest;
-				uint32_t *s = (uint32_t *)(src + si);
-				int scan = dw >> 2;
-				for (int j = 8; j; j--)
-				{
-					__asm__("pref @%0" : : "r"(s + scan));
-					d[0] = s[0];
-					d[1] = s[1];
-					d += 2;
-					s += scan;
-				}
-			}
+	}
+	source->y_x = hp & 7;
+	source->y_y = vp & 7;
+}
+
+void plm_video_mc_chroma_source(
+	plm_video_mc_source_t *source, plm_frame_t *reference, int hp, int vp
+) {
+	uint32_t *display = reference->display;
+	int mb_width = reference->y.width >> 4;
+	int dw = reference->cb.width;
+	int dh = reference->cb.height;
+
+	// The 2x2 chroma blocks, at the same positions in the grid
+	for (int r = 0; r < 2; r++) {
+		int by = plm_video_mc_clamp((vp >> 3) + r, dh >> 3);
+		for (int c = 0; c < 2; c++) {
+			int bx = plm_video_mc_clamp((hp >> 3) + c, dw >> 3);
+			source->cb[r * 3 + c] = display + (by * mb_width + bx) * 96;
+			source->cr[r * 3 + c] = source->cb[r * 3 + c] + 16;
 		}
-		dest += 16;
-		__asm__("pref @%0" : : "r"(dest));
-		src = reference->cr.data;
 	}
+	source->c_x = hp & 7;
+	source->c_y = vp & 7;
 }
 
+void plm_video_copy_macroblock(
+	uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v
+) {
+	plm_video_mc_source_t s;
+	plm_video_mc_source(&s, reference, motion_h, motion_v);
+
+	// Y blocks, top left, top right, bottom left, bottom right
+	PLM_PREFETCH(dest + 32);
+	plm_video_mc_block_t mc = PLM_VIDEO_MC_BLOCK[s.y_mode];
+	mc(dest + 32, s.y, s.y_x, s.y_y);
+	mc(dest + 48, s.y + 1, s.y_x, s.y_y);
+	mc(dest + 64, s.y + 3, s.y_x, s.y_y);
+	mc(dest + 80, s.y + 4, s.y_x, s.y_y);
+
+	// Cb, Cr blocks
+	PLM_PREFETCH(dest);
+	mc = PLM_VIDEO_MC_BLOCK[s.c_mode];
+	mc(dest, s.cb, s.c_x, s.c_y);
+	mc(dest + 16, s.cr, s.c_x, s.c_y);
+}
 
 void plm_video_interpolate_macroblock(
-	uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v
+	uint32_t *dest,
+	plm_frame_t *forward, int forward_h, int forward_v,
+	plm_frame_t *backward, int backward_h, int backward_v
 ) {
-	__attribute__((aligned(8))) static uint32_t buffer[96];
+	plm_video_mc_source_t f, b;
+	plm_video_mc_source(&f, forward, forward_h, forward_v);
+	plm_video_mc_source(&b, backward, backward_h, backward_v);
+
+	// Y blocks
+	PLM_PREFETCH(dest + 32);
+	plm_video_mc_bidir_block_t mc = PLM_VIDEO_MC_BIDIR_BLOCK[(f.y_mode << 2) | b.y_mode];
+	mc(dest + 32, f.y, f.y_x, f.y_y, b.y, b.y_x, b.y_y);
+	mc(dest + 48, f.y + 1, f.y_x, f.y_y, b.y + 1, b.y_x, b.y_y);
+	mc(dest + 64, f.y + 3, f.y_x, f.y_y, b.y + 3, b.y_x, b.y_y);
+	mc(dest + 80, f.y + 4, f.y_x, f.y_y, b.y + 4, b.y_x, b.y_y);
+
+	// Cb, Cr blocks
+	PLM_PREFETCH(dest);
+	mc = PLM_VIDEO_MC_BIDIR_BLOCK[(f.c_mode << 2) | b.c_mode];
+	mc(dest, f.cb, f.c_x, f.c_y, b.cb, b.c_x, b.c_y);
+	mc(dest + 16, f.cr, f.c_x, f.c_y, b.cr, b.c_x, b.c_y);
+}
 
-	plm_video_copy_macroblock(buffer, reference, motion_h, motion_v);
-	for(int i = 0; i < 96; i++)
-	{
-		dest[i] = (((dest[i] >> 1) & 0x7f7f7f7f) + ((buffer[i] >> 1) & 0x7f7f7f7f));
+// Prediction at a reduced scale. The vectors are scaled down to half pels of
+// the reduced reference, dropping the bits that fall below. Areas of 8x8
+// pixels use the kernels above, the smaller ones a generic loop over the same
+// rows that only stores the first 4 or 2 pixels of each.
+
+void plm_video_predict_reduced_macroblock(plm_video_t *self) {
+	int b_picture = self->picture_type == PLM_VIDEO_PICTURE_TYPE_B;
+	int forward = !b_picture || self->motion_forward.is_set;
+	int backward = b_picture && (self->motion_backward.is_set || !forward);
+
+	plm_video_mc_source_t f, b;
+	if (forward) {
+		plm_video_mc_reduced_source(self, &f, &self->frame_forward, &self->motion_forward);
+	}
+	if (backward) {
+		plm_video_mc_reduced_source(self, &b, &self->frame_backward, &self->motion_backward);
+		if (!forward) {
+			f = b;
+		}
+	}
+
+	uint8_t *luma, *chroma;
+	plm_video_reduced_area(
+		self, self->frame_current.display, self->macroblock_address, &luma, &chroma
+	);
+
+	int size = 16 >> self->scale_shift;
+	if (forward && backward) {
+		plm_video_mc_reduced_block(
+			luma, size, f.y, f.y_x, f.y_y, f.y_mode, b.y, b.y_x, b.y_y, b.y_mode
+		);
+		plm_video_mc_reduced_block(
+			chroma, size >> 1, f.cb, f.c_x, f.c_y, f.c_mode, b.cb, b.c_x, b.c_y, b.c_mode
+		);
+		plm_video_mc_reduced_block(
+			chroma + 64, size >> 1, f.cr, f.c_x, f.c_y, f.c_mode, b.cr, b.c_x, b.c_y, b.c_mode
+		);
+	}
+	else {
+		plm_video_mc_reduced_block(luma, size, f.y, f.y_x, f.y_y, f.y_mode, NULL, 0, 0, 0);
+		plm_video_mc_reduced_block(chroma, size >> 1, f.cb, f.c_x, f.c_y, f.c_mode, NULL, 0, 0, 0);
+		plm_video_mc_reduced_block(chroma + 64, size >> 1, f.cr, f.c_x, f.c_y, f.c_mode, NULL, 0, 0, 0);
 	}
 }
 
+void plm_video_mc_reduced_source(
+	plm_video_t *self, plm_video_mc_source_t *source,
+	plm_frame_t *reference, plm_video_motion_t *motion
+) {
+	int shift = self->scale_shift;
+	int size = 16 >> shift;
+	int motion_h = motion->h;
+	int motion_v = motion->v;
+
+	if (motion->full_px) {
+		motion_h <<= 1;
+		motion_v <<= 1;
+	}
+
+	// Positions in half pels of the reduced frame
+	int h = self->mb_col * size * 2 + (motion_h >> shift);
+	int v = self->mb_row * size * 2 + (motion_v >> shift);
+	plm_video_mc_luma_source(source, reference, h >> 1, v >> 1);
+	source->y_mode = ((v & 1) << 1) | (h & 1);
+
+	// Chroma vectors are half of the luma ones, rounded towards zero
+	h = self->mb_col * size + ((motion_h / 2) >> shift);
+	v = self->mb_row * size + ((motion_v / 2) >> shift);
+	plm_video_mc_chroma_source(source, reference, h >> 1, v >> 1);
+	source->c_mode = ((v & 1) << 1) | (h & 1);
+}
 
-void plm_video_decode_block(plm_video_t *self, int block) {
+void plm_video_mc_reduced_block(
+	uint8_t *d, int size,
+	const uint32_t **src, int x, int y, int mode,
+	const uint32_t **src2, int x2, int y2, int mode2
+) {
+	if (size == 8) {
+		if (src2) {
+			PLM_VIDEO_MC_BIDIR_BLOCK[(mode << 2) | mode2]((uint32_t *)d, src, x, y, src2, x2, y2);
+		}
+		else {
+			PLM_VIDEO_MC_BLOCK[mode]((uint32_t *)d, src, x, y);
+		}
+		return;
+	}
 
-	int n = 0;
-	uint8_t *quant_matrix;
+	plm_video_mc_rows_t forward, backward;
+	uint32_t p[2], q[2];
+	plm_video_mc_begin(&forward, src, x, y, mode & 1, mode >> 1);
+	if (!src2) {
+		for (int j = size; j; j--) {
+			plm_video_mc_row(&forward, p, mode & 1, mode >> 1);
+			memcpy(d, p, size);
+			d += 8;
+		}
+		return;
+	}
 
-	// Decode DC coefficient of intra-coded blocks
-	if (self->macroblock_intra) {
-		int predictor;
-		int dct_size;
-
-		// DC prediction
-		int plane_index = block > 3 ? block - 3 : 0;
-		predictor = self->dc_predictor[plane_index];
-		dct_size = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_DCT_SIZE[plane_index]);
-
-		// Read DC coeff
-		if (dct_size > 0) {
-			int differential = plm_buffer_read(self->buffer, dct_size);
-			if ((differential & (1 << (dct_size - 1))) != 0) {
-				self->block_data[0] = predictor + differential;
+	plm_video_mc_begin(&backward, src2, x2, y2, mode2 & 1, mode2 >> 1);
+	for (int j = size; j; j--) {
+		plm_video_mc_row(&forward, p, mode & 1, mode >> 1);
+		plm_video_mc_row(&backward, q, mode2 & 1, mode2 >> 1);
+		p[0] = plm_video_mc_avg2(p[0], q[0]);
+		memcpy(d, p, size);
+		d += 8;
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_idct_1d(
+	int *out, int stride,
+	int p0, int p1, int p2, int p3, int p4, int p5, int p6, int p7
+) {
+	int x0, x1, x2, x3, x4, y3, y4, y5, y6, y7;
+	int b1, b3, b4, b6, b7, tmp1, tmp2, m0;
+
+	tmp1 = p1 + p7;
+	tmp2 = p3 + p5;
+	b6 = p1 - p7;
+	b7 = tmp1 + tmp2;
+	m0 = p0;
+	b4 = p5 - p3;
+	b1 = p4;
+	b3 = p2 + p6;
+
+	x4 = ((b6 * 473 - b4 * 196 + 128) >> 8) - b7;
+	x0 = x4 - (((tmp1 - tmp2) * 362 + 128) >> 8);
+	x1 = m0 - b1;
+	x2 = (((p2 - p6) * 362 + 128) >> 8) - b3;
+	x3 = m0 + b1;
+	y3 = x1 + x2;
+	y4 = x3 + b3;
+	y5 = x1 - x2;
+	y6 = x3 - b3;
+	y7 = -x0 - ((b4 * 473 + b6 * 196 + 128) >> 8);
+
+	out[0 * stride] = b7 + y4;
+	out[1 * stride] = x4 + y3;
+	out[2 * stride] = y5 - x0;
+	out[3 * stride] = y6 - y7;
+	out[4 * stride] = y6 + y7;
+	out[5 * stride] = x0 + y5;
+	out[6 * stride] = y3 - x4;
+	out[7 * stride] = y4 - b7;
+}
+
+static inline __attribute__((always_inline)) void plm_video_store_row(uint8_t *d, const int *v, int add) {
+	if (add) {
+		d[0] = plm_clamp(d[0] + (v[0] >> 8));
+		d[1] = plm_clamp(d[1] + (v[1] >> 8));
+		d[2] = plm_clamp(d[2] + (v[2] >> 8));
+		d[3] = plm_clamp(d[3] + (v[3] >> 8));
+		d[4] = plm_clamp(d[4] + (v[4] >> 8));
+		d[5] = plm_clamp(d[5] + (v[5] >> 8));
+		d[6] = plm_clamp(d[6] + (v[6] >> 8));
+		d[7] = plm_clamp(d[7] + (v[7] >> 8));
+	}
+	else {
+		d[0] = plm_clamp(v[0] >> 8);
+		d[1] = plm_clamp(v[1] >> 8);
+		d[2] = plm_clamp(v[2] >> 8);
+		d[3] = plm_clamp(v[3] >> 8);
+		d[4] = plm_clamp(v[4] >> 8);
+		d[5] = plm_clamp(v[5] >> 8);
+		d[6] = plm_clamp(v[6] >> 8);
+		d[7] = plm_clamp(v[7] >> 8);
+	}
+}
+
+// Add value to each of the 4 pixels of a word, saturating at 0 and 255. The
+// lower 7 bits of each byte are added or subtracted without crossing into
+// the next byte, bit 7 is put back from the operands and the carry or borrow
+// out of each byte then sets or clears all of its bits.
+
+static inline __attribute__((always_inline)) uint32_t plm_video_add_saturate(uint32_t p, int value) {
+	if (value >= 0) {
+		uint32_t v = plm_clamp(value) * 0x01010101;
+		uint32_t sum = (p & 0x7f7f7f7f) + (v & 0x7f7f7f7f);
+		uint32_t carry = ((p & v) | ((p | v) & sum)) & 0x80808080;
+		sum ^= (p ^ v) & 0x80808080;
+		return sum | ((carry << 1) - (carry >> 7));
+	}
+	else {
+		uint32_t v = plm_clamp(-value) * 0x01010101;
+		uint32_t diff = (p | 0x80808080) - (v & 0x7f7f7f7f);
+		uint32_t borrow = ((~p & v) | (~(p ^ v) & ~diff)) & 0x80808080;
+		diff ^= ~(p ^ v) & 0x80808080;
+		return diff & ~((borrow << 1) - (borrow >> 7));
+	}
+}
+
+static inline __attribute__((always_inline)) void plm_video_fill_row(uint8_t *d, int value, int add) {
+	if (add) {
+		((uint32_t *)d)[0] = plm_video_add_saturate(((uint32_t *)d)[0], value);
+		((uint32_t *)d)[1] = plm_video_add_saturate(((uint32_t *)d)[1], value);
+	}
+	else {
+		uint32_t clamped = plm_clamp(value);
+		clamped |= (clamped << 24) | (clamped << 16) | (clamped << 8);
+		((uint32_t *)d)[0] = clamped;
+		((uint32_t *)d)[1] = clamped;
+	}
+}
+
+// Premultiply, IDCT and add (or store) one block of coefficients into an 8x8
+// block of the display buffer in one go, then clear the coefficients again.
+// The IDCT is the same as plm_video_idct(), with the rounding of the row pass
+// folded into the DC term. Blocks coded in the first row, first column or top
+// left 4x4 only skip the passes and terms that would just see zeros. rows and
+// cols have one bit set for each row and column coded.
+
+void plm_video_reconstruct_block(int16_t *block, uint8_t *d, int n, int rows, int cols, int add) {
+	const uint8_t *m = PLM_VIDEO_PREMULTIPLIER_MATRIX;
+	int v[8];
+
+	if (n == 1) {
+		// DC only
+		int value = (block[0] * m[0] + 128) >> 8;
+		for (int y = 8; y; y--) {
+			plm_video_fill_row(d, value, add);
+			d += 8;
+		}
+		block[0] = 0;
+	}
+	else if (rows == 1) {
+		// Only the first row is coded, so all rows come out the same
+		plm_video_idct_1d(
+			v, 1,
+			block[0] * m[0] + 128, block[1] * m[1], block[2] * m[2], block[3] * m[3],
+			block[4] * m[4], block[5] * m[5], block[6] * m[6], block[7] * m[7]
+		);
+		for (int y = 8; y; y--) {
+			plm_video_store_row(d, v, add);
+			d += 8;
+		}
+		memset(block, 0, 8 * sizeof(int16_t));
+	}
+	else if (cols == 1) {
+		// Only the first column is coded, so each row is a single value
+		plm_video_idct_1d(
+			v, 1,
+			block[0] * m[0] + 128, block[8] * m[8], block[16] * m[16], block[24] * m[24],
+			block[32] * m[32], block[40] * m[40], block[48] * m[48], block[56] * m[56]
+		);
+		for (int y = 0; y < 8; y++) {
+			plm_video_fill_row(d, v[y] >> 8, add);
+			d += 8;
+			block[y * 8] = 0;
+		}
+	}
+	else {
+		int tmp[64];
+
+		// Column pass, premultiplying the coefficients as they are loaded.
+		// Then the row pass, in place and straight into the display buffer.
+		if ((rows | cols) & 0xf0) {
+			for (int x = 0; x < 8; x++) {
+				int16_t *b = block + x;
+				const uint8_t *mx = m + x;
+				plm_video_idct_1d(
+					tmp + x, 8,
+					b[0] * mx[0], b[8] * mx[8], b[16] * mx[16], b[24] * mx[24],
+					b[32] * mx[32], b[40] * mx[40], b[48] * mx[48], b[56] * mx[56]
+				);
 			}
-			else {
-				self->block_data[0] = predictor + (-(1 << dct_size) | (differential + 1));
+			for (int y = 0; y < 64; y += 8) {
+				int *p = tmp + y;
+				plm_video_idct_1d(p, 1, p[0] + 128, p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+				plm_video_store_row(d, p, add);
+				d += 8;
 			}
 		}
 		else {
-			self->block_data[0] = predictor;
+			// Only the top left 4x4 is coded
+			for (int x = 0; x < 4; x++) {
+				int16_t *b = block + x;
+				const uint8_t *mx = m + x;
+				plm_video_idct_1d(
+					tmp + x, 8,
+					b[0] * mx[0], b[8] * mx[8], b[16] * mx[16], b[24] * mx[24],
+					0, 0, 0, 0
+				);
+			}
+			for (int y = 0; y < 64; y += 8) {
+				int *p = tmp + y;
+				plm_video_idct_1d(p, 1, p[0] + 128, p[1], p[2], p[3], 0, 0, 0, 0);
+				plm_video_store_row(d, p, add);
+				d += 8;
+			}
 		}
 
-		// Save predictor value
-		self->dc_predictor[plane_index] = self->block_data[0];
+		for (int y = 0; y < 8; y++) {
+			if (rows & (1 << y)) {
+				memset(block + y * 8, 0, 8 * sizeof(int16_t));
+			}
+		}
+	}
+}
 
-		// Dequantize + premultiply
-		self->block_data[0] <<= (3 + 5);
+// Read the DC coefficient of an intra-coded block and update its predictor
 
-		quant_matrix = self->intra_quant_matrix;
-		n = 1;
+static inline __attribute__((always_inline)) int plm_video_decode_dc(plm_video_t *self, int plane_index) {
+	int dc = self->dc_predictor[plane_index];
+	int dct_size = plm_buffer_read_vlc_lut(
+		self->buffer, plm_video_vlc_luts.dct_size[plane_index > 0],
+		PLM_VIDEO_DCT_SIZE_LUT_BITS, PLM_VIDEO_DCT_SIZE[plane_index]
+	);
+
+	if (dct_size > 0) {
+		int differential = plm_buffer_read(self->buffer, dct_size);
+		if ((differential & (1 << (dct_size - 1))) != 0) {
+			dc += differential;
+		}
+		else {
+			dc += -(1 << dct_size) | (differential + 1);
+		}
+	}
+
+	self->dc_predictor[plane_index] = dc;
+	return dc;
+}
+
+// The dequantization factors for the current quantizer_scale. They only
+// change with the scale or the matrices, so they are built on first use
+// instead of multiplying both for every coefficient.
+
+static inline __attribute__((always_inline)) const uint16_t *plm_video_quant_table(plm_video_t *self, int intra) {
+	if (self->quant_table_scale[intra] != self->quantizer_scale) {
+		plm_video_build_quant_table(self, intra);
+	}
+	return self->quant_table[intra];
+}
+
+void plm_video_build_quant_table(plm_video_t *self, int intra) {
+	const uint8_t *quant_matrix = intra ? self->intra_quant_matrix : self->non_intra_quant_matrix;
+	for (int i = 0; i < 64; i++) {
+		self->quant_table[intra][i] = self->quantizer_scale * quant_matrix[PLM_VIDEO_ZIG_ZAG[i]];
+	}
+	self->quant_table_scale[intra] = self->quantizer_scale;
+}
+
+// Move a decoded block to its place in the current display buffer. n is the
+// number of coefficients read, see plm_video_reconstruct_block().
+
+static inline __attribute__((always_inline)) void plm_video_store_block(
+	plm_video_t *self, int block, int n, int rows, int cols, int intra, int chroma
+) {
+	uint32_t *display = self->frame_current.display;
+
+	if (self->scale_shift) {
+		uint8_t *luma_area, *chroma_area;
+		plm_video_reduced_area(self, display, self->macroblock_address, &luma_area, &chroma_area);
+
+		int size = 8 >> self->scale_shift;
+		uint8_t *d = chroma
+			? chroma_area + (block - 4) * 64
+			: luma_area + (block >> 1) * size * 8 + (block & 1) * size;
+		plm_video_reconstruct_reduced(self->block_data, d, size, rows, cols, !intra);
+		return;
+	}
+
+	if (chroma) {
+		display += self->macroblock_address * 96 + (block - 4) * 16;
 	}
 	else {
-		quant_matrix = self->non_intra_quant_matrix;
+		display += self->macroblock_address * 96 + 32 + block * 16;
+	}
+
+	int16_t *s = self->block_data;
+	PLM_PREFETCH(s);
+
+	#ifdef PLM_VIDEO_REFERENCE_IDCT
+		plm_video_reconstruct_block_reference(s, (uint8_t *)display, !intra);
+	#else
+		// Intra blocks overwrite, the others add to the predicted macroblock
+		plm_video_reconstruct_block(s, (uint8_t *)display, n, rows, cols, !intra);
+	#endif
+}
+
+// Decode the coefficients of one block and reconstruct it. Instantiated for
+// intra and non-intra, luma and chroma blocks and for the DC-only blocks of
+// D-pictures, see PLM_DEFINE_DECODE_BLOCK_FUNCTION below.
+
+static inline __attribute__((always_inline)) void plm_video_decode_block_of(
+	plm_video_t *self, int block, int intra, int chroma, int dc_only
+) {
+	int n = 0;
+
+	// Rows and columns that received a coefficient, one bit each
+	int rows = 0;
+	int cols = 0;
+
+	// Decode DC coefficient of intra-coded blocks
+	if (intra) {
+		// Dequantize
+		self->block_data[0] = plm_video_decode_dc(self, chroma ? block - 3 : 0) << 3;
+
+		// D-pictures only have the DC coefficient, so each block is filled
+		// with a single value
+		if (dc_only) {
+			plm_video_store_block(self, block, 1, 1, 1, TRUE, chroma);
+			return;
+		}
+
+		n = 1;
+		rows = 1;
+		cols = 1;
 	}
+	const uint16_t *quant_table = plm_video_quant_table(self, intra);
 
 	// Decode AC coefficients (+DC for non-intra)
 	int level = 0;
 	while (TRUE) {
 		int run = 0;
-		uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
-
-		if ((coeff == 0x0001) && (n > 0) && (plm_buffer_read(self->buffer, 1) == 0)) {
-			// end_of_block
-			break;
+		uint16_t coeff;
+
+		if (((self->buffer->length << 3) - self->buffer->bit_index) >= 24) {
+			// Table lookup with sign and end_of_block already applied
+			const plm_vlc_lut_t *entry = plm_buffer_lookup_vlc(
+				self->buffer, plm_video_vlc_luts.dct_coeff[n > 0], PLM_VIDEO_DCT_COEFF_LUT_BITS
+			);
+			if (entry->extra == PLM_VIDEO_DCT_COEFF_END_OF_BLOCK) {
+				break;
+			}
+			coeff = entry->extra == PLM_VIDEO_DCT_COEFF_ESCAPE ? 0xffff : 0;
+			run = entry->extra;
+			level = entry->value;
 		}
+		else {
+			coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
+			if ((coeff == 0x0001) && (n > 0) && (plm_buffer_read(self->buffer, 1) == 0)) {
+				// end_of_block
+				break;
+			}
+			if (coeff != 0xffff) {
+				run = coeff >> 8;
+				level = coeff & 0xff;
+				if (plm_buffer_read(self->buffer, 1)) {
+					level = -level;
+				}
+			}
+		}
+
 		if (coeff == 0xffff) {
 			// escape
 			run = plm_buffer_read(self->buffer, 6);
@@ -3746,13 +6816,6 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 				level = level - 256;
 			}
 		}
-		else {
-			run = coeff >> 8;
-			level = coeff & 0xff;
-			if (plm_buffer_read(self->buffer, 1)) {
-				level = -level;
-			}
-		}
 
 		n += run;
 		if (n < 0 || n >= 64) {
@@ -3760,14 +6823,15 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 		}
 
 		int de_zig_zagged = PLM_VIDEO_ZIG_ZAG[n];
+		int factor = quant_table[n];
 		n++;
 
 		// Dequantize, oddify, clip
 		level <<= 1;
-		if (!self->macroblock_intra) {
+		if (!intra) {
 			level += (level < 0 ? -1 : 1);
 		}
-		level = (level * self->quantizer_scale * quant_matrix[de_zig_zagged]) >> 4;
+		level = (level * factor) >> 4;
 		if ((level & 1) == 0) {
 			level -= level > 0 ? 1 : -1;
 		}
@@ -3778,102 +6842,248 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 			level = -2048;
 		}
 
-		// Save premultiplied coefficient
-		self->block_data[de_zig_zagged] = level * PLM_VIDEO_PREMULTIPLIER_MATRIX[de_zig_zagged];
+		// Save coefficient; it is premultiplied by the IDCT
+		self->block_data[de_zig_zagged] = level;
+		rows |= 1 << (de_zig_zagged >> 3);
+		cols |= 1 << (de_zig_zagged & 7);
 	}
 
 	// Move block to its place
-	uint32_t *display = self->frame_current.display;
+	plm_video_store_block(self, block, n, rows, cols, intra, chroma);
+}
 
-	if (block < 4) {
-		display += self->macroblock_address * 96 + 32 + block * 16;
+#define PLM_DEFINE_DECODE_BLOCK_FUNCTION(NAME, INTRA, CHROMA, DC_ONLY) \
+	void NAME(plm_video_t *self, int block) { \
+		plm_video_decode_block_of(self, block, INTRA, CHROMA, DC_ONLY); \
 	}
-	else {
-		if(block == 4)
-		{
-			display += self->macroblock_address * 96;
+
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_intra_luma_block, TRUE, FALSE, FALSE)
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_intra_chroma_block, TRUE, TRUE, FALSE)
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_non_intra_luma_block, FALSE, FALSE, FALSE)
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_non_intra_chroma_block, FALSE, TRUE, FALSE)
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_dc_luma_block, TRUE, FALSE, TRUE)
+PLM_DEFINE_DECODE_BLOCK_FUNCTION(plm_video_decode_dc_chroma_block, TRUE, TRUE, TRUE)
+
+#undef PLM_DEFINE_DECODE_BLOCK_FUNCTION
+
+void plm_video_decode_thumbnail_slice(plm_video_t *self, int slice) {
+	uint8_t *d = (uint8_t *)self->thumbnail.display;
+	int mb_width = self->thumbnail.y.width >> 4;
+	int address = (slice - 1) * self->mb_width - 1;
+
+	self->dc_predictor[0] = 128;
+	self->dc_predictor[1] = 128;
+	self->dc_predictor[2] = 128;
+
+	// quantizer_scale; the DC coefficients of intra blocks don't use it
+	plm_buffer_skip(self->buffer, 5);
+
+	// Skip extra
+	while (plm_buffer_read(self->buffer, 1)) {
+		plm_buffer_skip(self->buffer, 8);
+	}
+
+	int slice_begin = TRUE;
+	do {
+		int increment = 0;
+		int t = plm_buffer_read_vlc_lut(
+			self->buffer, plm_video_vlc_luts.macroblock_address_increment,
+			PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+		);
+		while (t == 34 || t == 35) {
+			// macroblock_stuffing or macroblock_escape
+			if (t == 35) {
+				increment += 33;
+			}
+			t = plm_buffer_read_vlc_lut(
+				self->buffer, plm_video_vlc_luts.macroblock_address_increment,
+				PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT
+			);
 		}
-		else
-		{
-			display += self->macroblock_address * 96 + 16;
+		increment += t;
+
+		// Skipped macroblocks reset DC predictors
+		if (increment > 1 && !slice_begin) {
+			self->dc_predictor[0] = 128;
+			self->dc_predictor[1] = 128;
+			self->dc_predictor[2] = 128;
 		}
-	}
+		slice_begin = FALSE;
+
+		address += increment;
+		if (address < 0 || address >= self->mb_size) {
+			return; // corrupt stream
+		}
+		int row = address / self->mb_width;
+		int col = address % self->mb_width;
+
+		// All macroblocks of I- and D-pictures are intra-coded, with an
+		// optional quantizer_scale
+		int type = plm_buffer_read_vlc_lut(
+			self->buffer, plm_video_vlc_luts.macroblock_type[self->picture_type - 1],
+			PLM_VIDEO_MACROBLOCK_TYPE_LUT_BITS, PLM_VIDEO_MACROBLOCK_TYPE[self->picture_type]
+		);
+		if (type & 0x10) {
+			plm_buffer_skip(self->buffer, 5);
+		}
+
+		for (int block = 0; block < 6; block++) {
+			uint8_t value = plm_clamp(plm_video_decode_dc(self, block > 3 ? block - 3 : 0));
+			if (self->picture_type != PLM_VIDEO_PICTURE_TYPE_D) {
+				plm_video_skip_coefficients(self);
+			}
+
+			if (block < 4) {
+				d[plm_frame_luma_offset(mb_width, col * 2 + (block & 1), row * 2 + (block >> 1))] = value;
+			}
+			else {
+				d[plm_frame_chroma_offset(mb_width, col, row) + (block - 4) * 64] = value;
+			}
+		}
+
+		if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+			plm_buffer_skip(self->buffer, 1); // end_of_macroblock
+		}
+	} while (
+		address < self->mb_size - 1 &&
+		plm_buffer_peek_non_zero(self->buffer, 23)
+	);
+}
 
-	int *s = self->block_data;
-	__asm__("pref @%0" : : "r"(s));
+// Read past the AC coefficients of an intra block without decoding them
 
-	if (self->macroblock_intra) {
-		// Overwrite (no prediction)
-		if (n == 1) {
-			int clamped = plm_clamp((s[0] + 128) >> 8);
-			clamped |= (clamped << 24) | (clamped << 16) | (clamped << 8);
-			for (int y = 8; y; y--) {
-				*display++ = clamped;
-				*display++ = clamped;
+void plm_video_skip_coefficients(plm_video_t *self) {
+	for (int n = 1; n < 64; n++) {
+		if (((self->buffer->length << 3) - self->buffer->bit_index) >= 24) {
+			const plm_vlc_lut_t *entry = plm_buffer_lookup_vlc(
+				self->buffer, plm_video_vlc_luts.dct_coeff[1], PLM_VIDEO_DCT_COEFF_LUT_BITS
+			);
+			if (entry->extra == PLM_VIDEO_DCT_COEFF_END_OF_BLOCK) {
+				return;
+			}
+			if (entry->extra != PLM_VIDEO_DCT_COEFF_ESCAPE) {
+				continue;
 			}
-			s[0] = 0;
 		}
 		else {
-			plm_video_idct(s);
-			uint8_t *d = (uint8_t *)display;
-
-			for (int y = 8; y; y--) {
-				d[0] = plm_clamp(s[0]);
-				d[1] = plm_clamp(s[1]);
-				d[2] = plm_clamp(s[2]);
-				d[3] = plm_clamp(s[3]);
-				d[4] = plm_clamp(s[4]);
-				d[5] = plm_clamp(s[5]);
-				d[6] = plm_clamp(s[6]);
-				d[7] = plm_clamp(s[7]);
-				d += 8;
-				s += 8;
+			uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
+			if (coeff == 0x0001 && plm_buffer_read(self->buffer, 1) == 0) {
+				return; // end_of_block
 			}
-			s = self->block_data;
-			for (int y = 64; y; y--)
-				*s++ = 0;
+			if (coeff != 0xffff) {
+				plm_buffer_skip(self->buffer, 1); // sign
+				continue;
+			}
+		}
+
+		// escape: run and level
+		plm_buffer_skip(self->buffer, 6);
+		int level = plm_buffer_read(self->buffer, 8);
+		if (level == 0 || level == 128) {
+			plm_buffer_skip(self->buffer, 8);
 		}
 	}
+}
+
+void plm_video_reconstruct_block_reference(int16_t *block, uint8_t *d, int add) {
+	int s[64];
+	for (int i = 0; i < 64; i++) {
+		s[i] = block[i] * PLM_VIDEO_PREMULTIPLIER_MATRIX[i];
+	}
+	plm_video_idct(s);
+
+	for (int i = 0; i < 64; i++) {
+		d[i] = plm_clamp(add ? d[i] + s[i] : s[i]);
+	}
+	memset(block, 0, 64 * sizeof(int16_t));
+}
+
+// A 4 or 2 point IDCT over the lowest coefficients of an 8x8 block, with the
+// basis C(u) / 2 * cos((2 * x + 1) * u * PI / (2 * size)) in 12 fractional
+// bits. Applied to both dimensions it gives the 8x8 block scaled down to
+// size x size pixels. The even and odd halves are shared between the outputs
+// so that the 4 point version takes 6 multiplies instead of 16.
+
+#define PLM_VIDEO_REDUCED_C1 1892
+#define PLM_VIDEO_REDUCED_C2 1448
+#define PLM_VIDEO_REDUCED_C3 784
+
+static inline __attribute__((always_inline)) void plm_video_reduced_idct_1d(
+	int *out, int stride, int size, int c0, int c1, int c2, int c3
+) {
+	if (size == 4) {
+		int e0 = (c0 + c2) * PLM_VIDEO_REDUCED_C2;
+		int e1 = (c0 - c2) * PLM_VIDEO_REDUCED_C2;
+		int o0 = c1 * PLM_VIDEO_REDUCED_C1 + c3 * PLM_VIDEO_REDUCED_C3;
+		int o1 = c1 * PLM_VIDEO_REDUCED_C3 - c3 * PLM_VIDEO_REDUCED_C1;
+		out[0] = e0 + o0;
+		out[stride] = e1 + o1;
+		out[2 * stride] = e1 - o1;
+		out[3 * stride] = e0 - o0;
+	}
 	else {
-		// Add data to the predicted macroblock
-		uint8_t *d = (uint8_t *)display;
-		if (n == 1) {
-			int value = (s[0] + 128) >> 8;
-
-			for (int y = 8; y; y--) {
-				d[0] = plm_clamp(d[0] + value);
-				d[1] = plm_clamp(d[1] + value);
-				d[2] = plm_clamp(d[2] + value);
-				d[3] = plm_clamp(d[3] + value);
-				d[4] = plm_clamp(d[4] + value);
-				d[5] = plm_clamp(d[5] + value);
-				d[6] = plm_clamp(d[6] + value);
-				d[7] = plm_clamp(d[7] + value);
-				d += 8;
+		out[0] = (c0 + c1) * PLM_VIDEO_REDUCED_C2;
+		out[stride] = (c0 - c1) * PLM_VIDEO_REDUCED_C2;
+	}
+}
+
+void plm_video_reconstruct_reduced(int16_t *block, uint8_t *d, int size, int rows, int cols, int add) {
+	int t[16];
+
+	// Only the coded rows and columns within size x size have terms. The row
+	// pass stops after the last coded row, like plm_video_reconstruct_block().
+	int coded_rows = rows & ((1 << size) - 1);
+	int coded_cols = cols & ((1 << size) - 1);
+	int row_count = 1;
+	while (coded_rows >> row_count) {
+		row_count++;
+	}
+
+	if (row_count == 1 && coded_cols <= 1) {
+		// DC only, all pixels get the same value
+		int value = (((block[0] * PLM_VIDEO_REDUCED_C2) >> 8) * PLM_VIDEO_REDUCED_C2 + (1 << 15)) >> 16;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				d[x] = plm_clamp(add ? d[x] + value : value);
 			}
-			s[0] = 0;
+			d += 8;
 		}
-		else {
-			plm_video_idct(s);
-
-			for (int y = 8; y; y--) {
-				d[0] = plm_clamp(d[0] + s[0]);
-				d[1] = plm_clamp(d[1] + s[1]);
-				d[2] = plm_clamp(d[2] + s[2]);
-				d[3] = plm_clamp(d[3] + s[3]);
-				d[4] = plm_clamp(d[4] + s[4]);
-				d[5] = plm_clamp(d[5] + s[5]);
-				d[6] = plm_clamp(d[6] + s[6]);
-				d[7] = plm_clamp(d[7] + s[7]);
-				d += 8;
-				s += 8;
+	}
+	else {
+		// Rows, keeping 4 fractional bits; the rows after the last coded one
+		// are zero
+		for (int v = 0; v < row_count; v++) {
+			const int16_t *c = block + v * 8;
+			int *r = t + v * size;
+			plm_video_reduced_idct_1d(r, 1, size, c[0], c[1], c[2], c[3]);
+			for (int x = 0; x < size; x++) {
+				r[x] >>= 8;
+			}
+		}
+		for (int i = row_count * size; i < size * size; i++) {
+			t[i] = 0;
+		}
+
+		// Columns
+		int s[4];
+		for (int x = 0; x < size; x++) {
+			plm_video_reduced_idct_1d(s, 1, size, t[x], t[size + x], t[2 * size + x], t[3 * size + x]);
+			for (int y = 0; y < size; y++) {
+				int value = (s[y] + (1 << 15)) >> 16;
+				uint8_t *p = d + y * 8 + x;
+				*p = plm_clamp(add ? *p + value : value);
 			}
-			s = self->block_data;
-			for (int y = 64; y; y--)
-				*s++ = 0;
+		}
+	}
+
+	// Clear the coefficients of all coded rows, including the ones left out
+	for (int r = 0; rows; r++, rows >>= 1) {
+		if (rows & 1) {
+			memset(block + r * 8, 0, 8 * sizeof(int16_t));
 		}
 	}
 }
+
 // Ian micheal unrolled 2x
 void plm_video_idct(int *block) {
     int x0, x1, x2, x3, x4, y3, y4, y5, y6, y7;
@@ -3961,8 +7171,21 @@ void plm_video_idct(int *block) {
 // YCbCr conversion following the BT.601 standard:
 // https://infogalactic.com/info/YCbCr#ITU-R_BT.601_conversion
 
-#define PLM_PUT_PIXEL(RI, GI, BI, Y_OFFSET, DEST_OFFSET) \
-	y = ((frame->y.data[y_index + Y_OFFSET]-16) * 76309) >> 16; \
+// The frame data is macroblock ordered: each macroblock holds the 8x8 Cb, the
+// 8x8 Cr and then the four 8x8 Y blocks (top left, top right, bottom left,
+// bottom right), 384 bytes in total.
+
+static inline int plm_frame_luma_offset(int mb_width, int x, int y) {
+	return ((y >> 4) * mb_width + (x >> 4)) * 384 + 128 +
+		((y >> 3) & 1) * 128 + ((x >> 3) & 1) * 64 + (y & 7) * 8 + (x & 7);
+}
+
+static inline int plm_frame_chroma_offset(int mb_width, int x, int y) {
+	return ((y >> 3) * mb_width + (x >> 3)) * 384 + (y & 7) * 8 + (x & 7);
+}
+
+#define PLM_PUT_PIXEL(RI, GI, BI, X, Y, DEST_OFFSET) \
+	y = ((data[plm_frame_luma_offset(mb_width, X, Y)]-16) * 76309) >> 16; \
 	dest[d_index + DEST_OFFSET + RI] = plm_clamp(y + r); \
 	dest[d_index + DEST_OFFSET + GI] = plm_clamp(y - g); \
 	dest[d_index + DEST_OFFSET + BI] = plm_clamp(y + b);
@@ -3971,25 +7194,22 @@ void plm_video_idct(int *block) {
 	void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
 		int cols = frame->width >> 1; \
 		int rows = frame->height >> 1; \
-		int yw = frame->y.width; \
-		int cw = frame->cb.width; \
+		int mb_width = frame->y.width >> 4; \
+		const uint8_t *data = (const uint8_t *)frame->display; \
 		for (int row = 0; row < rows; row++) { \
-			int c_index = row * cw; \
-			int y_index = row * 2 * yw; \
 			int d_index = row * 2 * stride; \
 			for (int col = 0; col < cols; col++) { \
 				int y; \
-				int cr = frame->cr.data[c_index] - 128; \
-				int cb = frame->cb.data[c_index] - 128; \
+				int c_index = plm_frame_chroma_offset(mb_width, col, row); \
+				int cb = data[c_index] - 128; \
+				int cr = data[c_index + 64] - 128; \
 				int r = (cr * 104597) >> 16; \
 				int g = (cb * 25674 + cr * 53278) >> 16; \
 				int b = (cb * 132201) >> 16; \
-				PLM_PUT_PIXEL(RI, GI, BI, 0,      0); \
-				PLM_PUT_PIXEL(RI, GI, BI, 1,      BYTES_PER_PIXEL); \
-				PLM_PUT_PIXEL(RI, GI, BI, yw,     stride); \
-				PLM_PUT_PIXEL(RI, GI, BI, yw + 1, stride + BYTES_PER_PIXEL); \
-				c_index += 1; \
-				y_index += 2; \
+				PLM_PUT_PIXEL(RI, GI, BI, col * 2,     row * 2,     0); \
+				PLM_PUT_PIXEL(RI, GI, BI, col * 2 + 1, row * 2,     BYTES_PER_PIXEL); \
+				PLM_PUT_PIXEL(RI, GI, BI, col * 2,     row * 2 + 1, stride); \
+				PLM_PUT_PIXEL(RI, GI, BI, col * 2 + 1, row * 2 + 1, stride + BYTES_PER_PIXEL); \
 				d_index += 2 * BYTES_PER_PIXEL; \
 			} \
 		} \
@@ -4365,8 +7585,8 @@ int plm_audio_find_frame_sync(plm_audio_t *self) {
 	size_t i;
 	for (i = self->buffer->bit_index >> 3; i < self->buffer->length-1; i++) {
 		if (
-			self->buffer->bytes[i] == 0xFF &&
-			(self->buffer->bytes[i+1] & 0xFE) == 0xFC
+			plm_buffer_get_byte(self->buffer, i) == 0xFF &&
+			(plm_buffer_get_byte(self->buffer, i+1) & 0xFE) == 0xFC
 		) {
 			self->buffer->bit_index = ((i+1) << 3) + 3;
 			return TRUE;
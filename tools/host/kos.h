@@ -0,0 +1,85 @@
+// kos.h - the subset of KallistiOS used by pl_mpeg.h, on top of POSIX
+//
+// This lets the host tools and tests compile pl_mpeg.h unchanged: add this
+// directory to the include path (-Itools/host) and link with -lpthread -lm.
+// File handles are POSIX file descriptors, threads are pthreads.
+
+#ifndef PLM_HOST_KOS_H
+#define PLM_HOST_KOS_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Files; pl_mpeg.h only ever opens for reading. To stand in for a slow drive
+// such as the GD-ROM, every read first sleeps for the number of microseconds
+// in the PLM_HOST_READ_DELAY_US environment variable, if set.
+
+static inline ssize_t kos_host_fs_read(int fh, void *bytes, size_t length) {
+	static int delay_us = -1;
+	if (delay_us < 0) {
+		const char *delay = getenv("PLM_HOST_READ_DELAY_US");
+		delay_us = delay ? atoi(delay) : 0;
+	}
+	if (delay_us > 0) {
+		usleep(delay_us);
+	}
+	return read(fh, bytes, length);
+}
+
+#define fs_open(path, mode) open(path, O_RDONLY)
+#define fs_read(fh, bytes, length) kos_host_fs_read(fh, bytes, length)
+#define fs_seek(fh, offset, whence) lseek(fh, offset, whence)
+#define fs_tell(fh) lseek(fh, 0, SEEK_CUR)
+#define fs_close(fh) close(fh)
+
+// Threads
+
+typedef pthread_t kthread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t condvar_t;
+
+#define MUTEX_TYPE_NORMAL 0
+
+#define mutex_init(m, type) pthread_mutex_init(m, NULL)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+
+#define cond_init(c) pthread_cond_init(c, NULL)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_signal(c) pthread_cond_signal(c)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#define cond_destroy(c) pthread_cond_destroy(c)
+
+typedef pthread_once_t kthread_once_t;
+
+#define KTHREAD_ONCE_INIT PTHREAD_ONCE_INIT
+
+#define kthread_once(once, routine) pthread_once(once, routine)
+
+static inline kthread_t *thd_create(int detach, void *(*routine)(void *), void *param) {
+	kthread_t *thread = (kthread_t *)malloc(sizeof(kthread_t));
+	if (!thread) {
+		return NULL;
+	}
+	if (pthread_create(thread, NULL, routine, param) != 0) {
+		free(thread);
+		return NULL;
+	}
+	if (detach) {
+		pthread_detach(*thread);
+	}
+	return thread;
+}
+
+static inline int thd_join(kthread_t *thread, void **value_ptr) {
+	int result = pthread_join(*thread, value_ptr);
+	free(thread);
+	return result;
+}
+
+#endif // PLM_HOST_KOS_H
@@ -0,0 +1,573 @@
+// pl_mpeg_dcpreview - convert the intra frames of an MPEG-1 video to D-pictures
+//
+// Usage: pl_mpeg_dcpreview input.mpg [output.m1v]
+//
+// D-pictures only carry the DC coefficient of each 8x8 block. pl_mpeg decodes
+// them by filling every block with a single value, without an IDCT or motion
+// compensation, which makes them a very cheap preview track for fast seeking
+// and thumbnails. Common encoders don't produce them, so this runs on the host
+// (make tools) and builds one from an existing video: each I-picture is kept
+// with its DC coefficients, the AC coefficients and quantizer changes are
+// dropped and P- and B-pictures are left out entirely. Sequence and GOP
+// headers are copied unchanged.
+//
+// The input is either a program stream, of which the first video stream is
+// used, or a video elementary stream. The output is a video elementary stream
+// with one D-picture per I-picture of the input, so encode the source with
+// every frame intra to keep the preview in step with the frame rate. The output
+// defaults to the input filename with ".m1v" appended.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_HEADER 0xBA
+#define SYSTEM_HEADER 0xBB
+#define PACKET_VIDEO_1 0xE0
+
+#define START_PICTURE 0x00
+#define START_SLICE_FIRST 0x01
+#define START_SLICE_LAST 0xAF
+#define START_SEQUENCE 0xB3
+#define START_SEQUENCE_END 0xB7
+#define START_GOP 0xB8
+
+#define PICTURE_TYPE_INTRA 1
+#define PICTURE_TYPE_D 4
+
+#define MACROBLOCK_STUFFING 34
+#define MACROBLOCK_ESCAPE 35
+#define DCT_COEFF_ESCAPE 0xffff
+
+typedef struct {
+	int16_t index;
+	uint16_t value;
+} vlc_t;
+
+typedef struct {
+	const uint8_t *bytes;
+	size_t length;
+	size_t bit_index;
+} reader_t;
+
+typedef struct {
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+	int bit_count;
+} writer_t;
+
+static const vlc_t MACROBLOCK_ADDRESS_INCREMENT[] = {
+	{  1 << 1,    0}, {       0,    1},  //   0: x
+	{  2 << 1,    0}, {  3 << 1,    0},  //   1: 0x
+	{  4 << 1,    0}, {  5 << 1,    0},  //   2: 00x
+	{       0,    3}, {       0,    2},  //   3: 01x
+	{  6 << 1,    0}, {  7 << 1,    0},  //   4: 000x
+	{       0,    5}, {       0,    4},  //   5: 001x
+	{  8 << 1,    0}, {  9 << 1,    0},  //   6: 0000x
+	{       0,    7}, {       0,    6},  //   7: 0001x
+	{ 10 << 1,    0}, { 11 << 1,    0},  //   8: 0000 0x
+	{ 12 << 1,    0}, { 13 << 1,    0},  //   9: 0000 1x
+	{ 14 << 1,    0}, { 15 << 1,    0},  //  10: 0000 00x
+	{ 16 << 1,    0}, { 17 << 1,    0},  //  11: 0000 01x
+	{ 18 << 1,    0}, { 19 << 1,    0},  //  12: 0000 10x
+	{       0,    9}, {       0,    8},  //  13: 0000 11x
+	{      -1,    0}, { 20 << 1,    0},  //  14: 0000 000x
+	{      -1,    0}, { 21 << 1,    0},  //  15: 0000 001x
+	{ 22 << 1,    0}, { 23 << 1,    0},  //  16: 0000 010x
+	{       0,   15}, {       0,   14},  //  17: 0000 011x
+	{       0,   13}, {       0,   12},  //  18: 0000 100x
+	{       0,   11}, {       0,   10},  //  19: 0000 101x
+	{ 24 << 1,    0}, { 25 << 1,    0},  //  20: 0000 0001x
+	{ 26 << 1,    0}, { 27 << 1,    0},  //  21: 0000 0011x
+	{ 28 << 1,    0}, { 29 << 1,    0},  //  22: 0000 0100x
+	{ 30 << 1,    0}, { 31 << 1,    0},  //  23: 0000 0101x
+	{ 32 << 1,    0}, {      -1,    0},  //  24: 0000 0001 0x
+	{      -1,    0}, { 33 << 1,    0},  //  25: 0000 0001 1x
+	{ 34 << 1,    0}, { 35 << 1,    0},  //  26: 0000 0011 0x
+	{ 36 << 1,    0}, { 37 << 1,    0},  //  27: 0000 0011 1x
+	{ 38 << 1,    0}, { 39 << 1,    0},  //  28: 0000 0100 0x
+	{       0,   21}, {       0,   20},  //  29: 0000 0100 1x
+	{       0,   19}, {       0,   18},  //  30: 0000 0101 0x
+	{       0,   17}, {       0,   16},  //  31: 0000 0101 1x
+	{       0,   35}, {      -1,    0},  //  32: 0000 0001 00x
+	{      -1,    0}, {       0,   34},  //  33: 0000 0001 11x
+	{       0,   33}, {       0,   32},  //  34: 0000 0011 00x
+	{       0,   31}, {       0,   30},  //  35: 0000 0011 01x
+	{       0,   29}, {       0,   28},  //  36: 0000 0011 10x
+	{       0,   27}, {       0,   26},  //  37: 0000 0011 11x
+	{       0,   25}, {       0,   24},  //  38: 0000 0100 00x
+	{       0,   23}, {       0,   22},  //  39: 0000 0100 01x
+};
+
+static const vlc_t DCT_SIZE_LUMINANCE[] = {
+	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
+	{       0,    1}, {       0,    2},  //   1: 0x
+	{  3 << 1,    0}, {  4 << 1,    0},  //   2: 1x
+	{       0,    0}, {       0,    3},  //   3: 10x
+	{       0,    4}, {  5 << 1,    0},  //   4: 11x
+	{       0,    5}, {  6 << 1,    0},  //   5: 111x
+	{       0,    6}, {  7 << 1,    0},  //   6: 1111x
+	{       0,    7}, {  8 << 1,    0},  //   7: 1111 1x
+	{       0,    8}, {      -1,    0},  //   8: 1111 11x
+};
+
+static const vlc_t DCT_SIZE_CHROMINANCE[] = {
+	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
+	{       0,    0}, {       0,    1},  //   1: 0x
+	{       0,    2}, {  3 << 1,    0},  //   2: 1x
+	{       0,    3}, {  4 << 1,    0},  //   3: 11x
+	{       0,    4}, {  5 << 1,    0},  //   4: 111x
+	{       0,    5}, {  6 << 1,    0},  //   5: 1111x
+	{       0,    6}, {  7 << 1,    0},  //   6: 1111 1x
+	{       0,    7}, {  8 << 1,    0},  //   7: 1111 11x
+	{       0,    8}, {      -1,    0},  //   8: 1111 111x
+};
+
+static const vlc_t DCT_COEFF[] = {
+	{  1 << 1,        0}, {       0,   0x0001},  //   0: x
+	{  2 << 1,        0}, {  3 << 1,        0},  //   1: 0x
+	{  4 << 1,        0}, {  5 << 1,        0},  //   2: 00x
+	{  6 << 1,        0}, {       0,   0x0101},  //   3: 01x
+	{  7 << 1,        0}, {  8 << 1,        0},  //   4: 000x
+	{  9 << 1,        0}, { 10 << 1,        0},  //   5: 001x
+	{       0,   0x0002}, {       0,   0x0201},  //   6: 010x
+	{ 11 << 1,        0}, { 12 << 1,        0},  //   7: 0000x
+	{ 13 << 1,        0}, { 14 << 1,        0},  //   8: 0001x
+	{ 15 << 1,        0}, {       0,   0x0003},  //   9: 0010x
+	{       0,   0x0401}, {       0,   0x0301},  //  10: 0011x
+	{ 16 << 1,        0}, {       0,   0xffff},  //  11: 0000 0x
+	{ 17 << 1,        0}, { 18 << 1,        0},  //  12: 0000 1x
+	{       0,   0x0701}, {       0,   0x0601},  //  13: 0001 0x
+	{       0,   0x0102}, {       0,   0x0501},  //  14: 0001 1x
+	{ 19 << 1,        0}, { 20 << 1,        0},  //  15: 0010 0x
+	{ 21 << 1,        0}, { 22 << 1,        0},  //  16: 0000 00x
+	{       0,   0x0202}, {       0,   0x0901},  //  17: 0000 10x
+	{       0,   0x0004}, {       0,   0x0801},  //  18: 0000 11x
+	{ 23 << 1,        0}, { 24 << 1,        0},  //  19: 0010 00x
+	{ 25 << 1,        0}, { 26 << 1,        0},  //  20: 0010 01x
+	{ 27 << 1,        0}, { 28 << 1,        0},  //  21: 0000 000x
+	{ 29 << 1,        0}, { 30 << 1,        0},  //  22: 0000 001x
+	{       0,   0x0d01}, {       0,   0x0006},  //  23: 0010 000x
+	{       0,   0x0c01}, {       0,   0x0b01},  //  24: 0010 001x
+	{       0,   0x0302}, {       0,   0x0103},  //  25: 0010 010x
+	{       0,   0x0005}, {       0,   0x0a01},  //  26: 0010 011x
+	{ 31 << 1,        0}, { 32 << 1,        0},  //  27: 0000 0000x
+	{ 33 << 1,        0}, { 34 << 1,        0},  //  28: 0000 0001x
+	{ 35 << 1,        0}, { 36 << 1,        0},  //  29: 0000 0010x
+	{ 37 << 1,        0}, { 38 << 1,        0},  //  30: 0000 0011x
+	{ 39 << 1,        0}, { 40 << 1,        0},  //  31: 0000 0000 0x
+	{ 41 << 1,        0}, { 42 << 1,        0},  //  32: 0000 0000 1x
+	{ 43 << 1,        0}, { 44 << 1,        0},  //  33: 0000 0001 0x
+	{ 45 << 1,        0}, { 46 << 1,        0},  //  34: 0000 0001 1x
+	{       0,   0x1001}, {       0,   0x0502},  //  35: 0000 0010 0x
+	{       0,   0x0007}, {       0,   0x0203},  //  36: 0000 0010 1x
+	{       0,   0x0104}, {       0,   0x0f01},  //  37: 0000 0011 0x
+	{       0,   0x0e01}, {       0,   0x0402},  //  38: 0000 0011 1x
+	{ 47 << 1,        0}, { 48 << 1,        0},  //  39: 0000 0000 00x
+	{ 49 << 1,        0}, { 50 << 1,        0},  //  40: 0000 0000 01x
+	{ 51 << 1,        0}, { 52 << 1,        0},  //  41: 0000 0000 10x
+	{ 53 << 1,        0}, { 54 << 1,        0},  //  42: 0000 0000 11x
+	{ 55 << 1,        0}, { 56 << 1,        0},  //  43: 0000 0001 00x
+	{ 57 << 1,        0}, { 58 << 1,        0},  //  44: 0000 0001 01x
+	{ 59 << 1,        0}, { 60 << 1,        0},  //  45: 0000 0001 10x
+	{ 61 << 1,        0}, { 62 << 1,        0},  //  46: 0000 0001 11x
+	{      -1,        0}, { 63 << 1,        0},  //  47: 0000 0000 000x
+	{ 64 << 1,        0}, { 65 << 1,        0},  //  48: 0000 0000 001x
+	{ 66 << 1,        0}, { 67 << 1,        0},  //  49: 0000 0000 010x
+	{ 68 << 1,        0}, { 69 << 1,        0},  //  50: 0000 0000 011x
+	{ 70 << 1,        0}, { 71 << 1,        0},  //  51: 0000 0000 100x
+	{ 72 << 1,        0}, { 73 << 1,        0},  //  52: 0000 0000 101x
+	{ 74 << 1,        0}, { 75 << 1,        0},  //  53: 0000 0000 110x
+	{ 76 << 1,        0}, { 77 << 1,        0},  //  54: 0000 0000 111x
+	{       0,   0x000b}, {       0,   0x0802},  //  55: 0000 0001 000x
+	{       0,   0x0403}, {       0,   0x000a},  //  56: 0000 0001 001x
+	{       0,   0x0204}, {       0,   0x0702},  //  57: 0000 0001 010x
+	{       0,   0x1501}, {       0,   0x1401},  //  58: 0000 0001 011x
+	{       0,   0x0009}, {       0,   0x1301},  //  59: 0000 0001 100x
+	{       0,   0x1201}, {       0,   0x0105},  //  60: 0000 0001 101x
+	{       0,   0x0303}, {       0,   0x0008},  //  61: 0000 0001 110x
+	{       0,   0x0602}, {       0,   0x1101},  //  62: 0000 0001 111x
+	{ 78 << 1,        0}, { 79 << 1,        0},  //  63: 0000 0000 0001x
+	{ 80 << 1,        0}, { 81 << 1,        0},  //  64: 0000 0000 0010x
+	{ 82 << 1,        0}, { 83 << 1,        0},  //  65: 0000 0000 0011x
+	{ 84 << 1,        0}, { 85 << 1,        0},  //  66: 0000 0000 0100x
+	{ 86 << 1,        0}, { 87 << 1,        0},  //  67: 0000 0000 0101x
+	{ 88 << 1,        0}, { 89 << 1,        0},  //  68: 0000 0000 0110x
+	{ 90 << 1,        0}, { 91 << 1,        0},  //  69: 0000 0000 0111x
+	{       0,   0x0a02}, {       0,   0x0902},  //  70: 0000 0000 1000x
+	{       0,   0x0503}, {       0,   0x0304},  //  71: 0000 0000 1001x
+	{       0,   0x0205}, {       0,   0x0107},  //  72: 0000 0000 1010x
+	{       0,   0x0106}, {       0,   0x000f},  //  73: 0000 0000 1011x
+	{       0,   0x000e}, {       0,   0x000d},  //  74: 0000 0000 1100x
+	{       0,   0x000c}, {       0,   0x1a01},  //  75: 0000 0000 1101x
+	{       0,   0x1901}, {       0,   0x1801},  //  76: 0000 0000 1110x
+	{       0,   0x1701}, {       0,   0x1601},  //  77: 0000 0000 1111x
+	{ 92 << 1,        0}, { 93 << 1,        0},  //  78: 0000 0000 0001 0x
+	{ 94 << 1,        0}, { 95 << 1,        0},  //  79: 0000 0000 0001 1x
+	{ 96 << 1,        0}, { 97 << 1,        0},  //  80: 0000 0000 0010 0x
+	{ 98 << 1,        0}, { 99 << 1,        0},  //  81: 0000 0000 0010 1x
+	{100 << 1,        0}, {101 << 1,        0},  //  82: 0000 0000 0011 0x
+	{102 << 1,        0}, {103 << 1,        0},  //  83: 0000 0000 0011 1x
+	{       0,   0x001f}, {       0,   0x001e},  //  84: 0000 0000 0100 0x
+	{       0,   0x001d}, {       0,   0x001c},  //  85: 0000 0000 0100 1x
+	{       0,   0x001b}, {       0,   0x001a},  //  86: 0000 0000 0101 0x
+	{       0,   0x0019}, {       0,   0x0018},  //  87: 0000 0000 0101 1x
+	{       0,   0x0017}, {       0,   0x0016},  //  88: 0000 0000 0110 0x
+	{       0,   0x0015}, {       0,   0x0014},  //  89: 0000 0000 0110 1x
+	{       0,   0x0013}, {       0,   0x0012},  //  90: 0000 0000 0111 0x
+	{       0,   0x0011}, {       0,   0x0010},  //  91: 0000 0000 0111 1x
+	{104 << 1,        0}, {105 << 1,        0},  //  92: 0000 0000 0001 00x
+	{106 << 1,        0}, {107 << 1,        0},  //  93: 0000 0000 0001 01x
+	{108 << 1,        0}, {109 << 1,        0},  //  94: 0000 0000 0001 10x
+	{110 << 1,        0}, {111 << 1,        0},  //  95: 0000 0000 0001 11x
+	{       0,   0x0028}, {       0,   0x0027},  //  96: 0000 0000 0010 00x
+	{       0,   0x0026}, {       0,   0x0025},  //  97: 0000 0000 0010 01x
+	{       0,   0x0024}, {       0,   0x0023},  //  98: 0000 0000 0010 10x
+	{       0,   0x0022}, {       0,   0x0021},  //  99: 0000 0000 0010 11x
+	{       0,   0x0020}, {       0,   0x010e},  // 100: 0000 0000 0011 00x
+	{       0,   0x010d}, {       0,   0x010c},  // 101: 0000 0000 0011 01x
+	{       0,   0x010b}, {       0,   0x010a},  // 102: 0000 0000 0011 10x
+	{       0,   0x0109}, {       0,   0x0108},  // 103: 0000 0000 0011 11x
+	{       0,   0x0112}, {       0,   0x0111},  // 104: 0000 0000 0001 000x
+	{       0,   0x0110}, {       0,   0x010f},  // 105: 0000 0000 0001 001x
+	{       0,   0x0603}, {       0,   0x1002},  // 106: 0000 0000 0001 010x
+	{       0,   0x0f02}, {       0,   0x0e02},  // 107: 0000 0000 0001 011x
+	{       0,   0x0d02}, {       0,   0x0c02},  // 108: 0000 0000 0001 100x
+	{       0,   0x0b02}, {       0,   0x1f01},  // 109: 0000 0000 0001 101x
+	{       0,   0x1e01}, {       0,   0x1d01},  // 110: 0000 0000 0001 110x
+	{       0,   0x1c01}, {       0,   0x1b01},  // 111: 0000 0000 0001 111x
+};
+
+static const vlc_t *DCT_SIZE[] = {
+	DCT_SIZE_LUMINANCE,
+	DCT_SIZE_LUMINANCE,
+	DCT_SIZE_LUMINANCE,
+	DCT_SIZE_LUMINANCE,
+	DCT_SIZE_CHROMINANCE,
+	DCT_SIZE_CHROMINANCE
+};
+
+static uint8_t *read_file(const char *filename, size_t *length) {
+	FILE *fh = fopen(filename, "rb");
+	if (!fh) {
+		return NULL;
+	}
+	fseek(fh, 0, SEEK_END);
+	*length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+
+	uint8_t *bytes = malloc(*length + 1);
+	if (fread(bytes, 1, *length, fh) != *length) {
+		free(bytes);
+		bytes = NULL;
+	}
+	fclose(fh);
+	return bytes;
+}
+
+static int read_bits(reader_t *r, int count) {
+	int value = 0;
+	while (count--) {
+		int bit = 0;
+		if (r->bit_index < r->length << 3) {
+			bit = (r->bytes[r->bit_index >> 3] >> (7 - (r->bit_index & 7))) & 1;
+		}
+		value = (value << 1) | bit;
+		r->bit_index++;
+	}
+	return value;
+}
+
+static uint16_t read_vlc(reader_t *r, const vlc_t *table) {
+	vlc_t state = {0, 0};
+	do {
+		state = table[state.index + read_bits(r, 1)];
+	} while (state.index > 0);
+	return state.value;
+}
+
+static int has_start_code(reader_t *r) {
+	if (r->bit_index + 23 > r->length << 3) {
+		return 1;
+	}
+	size_t bit_index = r->bit_index;
+	int bits = read_bits(r, 23);
+	r->bit_index = bit_index;
+	return bits == 0;
+}
+
+static void write_bits(writer_t *w, int value, int count) {
+	while (count--) {
+		if (w->bit_count == 0) {
+			if (w->length == w->capacity) {
+				w->capacity *= 2;
+				w->bytes = realloc(w->bytes, w->capacity);
+			}
+			w->bytes[w->length++] = 0;
+		}
+		if ((value >> count) & 1) {
+			w->bytes[w->length - 1] |= 0x80 >> w->bit_count;
+		}
+		w->bit_count = (w->bit_count + 1) & 7;
+	}
+}
+
+static void write_start_code(writer_t *w, int code) {
+	w->bit_count = 0; // pad the last byte with zeros
+	write_bits(w, 0x000001, 24);
+	write_bits(w, code, 8);
+}
+
+static void copy_bits(writer_t *w, const reader_t *r, size_t from) {
+	reader_t copy = *r;
+	copy.bit_index = from;
+	while (copy.bit_index < r->bit_index) {
+		write_bits(w, read_bits(&copy, 1), 1);
+	}
+}
+
+static size_t find_start_code(const uint8_t *bytes, size_t length, size_t pos) {
+	for (; pos + 4 <= length; pos++) {
+		if (bytes[pos] == 0x00 && bytes[pos + 1] == 0x00 && bytes[pos + 2] == 0x01) {
+			return pos;
+		}
+	}
+	return length;
+}
+
+// Collect the payload of the first video stream. Pack headers are skipped,
+// every other start code is followed by a packet length.
+static uint8_t *demux_video(const uint8_t *bytes, size_t length, size_t *video_length) {
+	uint8_t *video = malloc(length);
+	*video_length = 0;
+
+	size_t pos = 0;
+	while ((pos = find_start_code(bytes, length, pos)) + 6 <= length) {
+		int code = bytes[pos + 3];
+		pos += 4;
+		if (code == PACK_HEADER) {
+			pos += 8;
+			continue;
+		}
+		if (code < SYSTEM_HEADER) {
+			continue;
+		}
+
+		size_t packet_end = pos + 2 + ((bytes[pos] << 8) | bytes[pos + 1]);
+		if (packet_end > length) {
+			break;
+		}
+
+		size_t p = pos + 2;
+		pos = packet_end;
+		if (code != PACKET_VIDEO_1) {
+			continue;
+		}
+
+		while (p < packet_end && bytes[p] == 0xff) {
+			p++; // stuffing
+		}
+		if (p < packet_end && (bytes[p] >> 6) == 0x01) {
+			p += 2; // P-STD
+		}
+		if (p < packet_end) {
+			int pts_dts_marker = (bytes[p] >> 4) & 0x03;
+			p += pts_dts_marker == 0x03 ? 10 : pts_dts_marker == 0x02 ? 5 : 1;
+		}
+		if (p < packet_end) {
+			memcpy(video + *video_length, bytes + p, packet_end - p);
+			*video_length += packet_end - p;
+		}
+	}
+	return video;
+}
+
+// Skip the AC coefficients of an intra block up to and including its
+// end_of_block code.
+static void skip_coefficients(reader_t *r) {
+	for (int n = 1; n < 64; n++) {
+		uint16_t coeff = read_vlc(r, DCT_COEFF);
+		if (coeff == 0x0001 && read_bits(r, 1) == 0) {
+			return; // end_of_block
+		}
+		if (coeff != DCT_COEFF_ESCAPE) {
+			read_bits(r, 1); // sign
+			continue;
+		}
+
+		// escape: run and level
+		read_bits(r, 6);
+		int level = read_bits(r, 8);
+		if (level == 0 || level == 128) {
+			read_bits(r, 8);
+		}
+	}
+}
+
+// Convert the slice starting at the reader. Returns 0 if the data is broken,
+// in which case the rest of the slice is lost.
+static int convert_slice(writer_t *w, reader_t *r, int code, int picture_type) {
+	write_start_code(w, code);
+	write_bits(w, read_bits(r, 5), 5); // quantizer_scale
+	while (read_bits(r, 1)) {
+		read_bits(r, 8); // extra_information_slice
+	}
+	write_bits(w, 0, 1);
+
+	do {
+		// macroblock_address_increment, without stuffing
+		for (;;) {
+			size_t from = r->bit_index;
+			uint16_t increment = read_vlc(r, MACROBLOCK_ADDRESS_INCREMENT);
+			if (increment == 0) {
+				return 0;
+			}
+			if (increment == MACROBLOCK_STUFFING) {
+				continue;
+			}
+			copy_bits(w, r, from);
+			if (increment != MACROBLOCK_ESCAPE) {
+				break;
+			}
+		}
+
+		// macroblock_type: intra, optionally with a quantizer_scale that
+		// doesn't affect the DC coefficients.
+		if (!read_bits(r, 1)) {
+			if (picture_type == PICTURE_TYPE_D || !read_bits(r, 1)) {
+				return 0;
+			}
+			read_bits(r, 5);
+		}
+		write_bits(w, 1, 1);
+
+		for (int i = 0; i < 6; i++) {
+			size_t from = r->bit_index;
+			vlc_t state = {0, 0};
+			do {
+				state = DCT_SIZE[i][state.index + read_bits(r, 1)];
+			} while (state.index > 0);
+			if (state.index < 0) {
+				return 0;
+			}
+			read_bits(r, state.value);
+			copy_bits(w, r, from);
+
+			if (picture_type == PICTURE_TYPE_INTRA) {
+				skip_coefficients(r);
+			}
+		}
+
+		if (picture_type == PICTURE_TYPE_D) {
+			read_bits(r, 1);
+		}
+		write_bits(w, 1, 1); // end_of_macroblock
+	} while (!has_start_code(r));
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s input.mpg [output.m1v]\n", argv[0]);
+		return 1;
+	}
+
+	size_t length;
+	uint8_t *bytes = read_file(argv[1], &length);
+	if (!bytes) {
+		printf("Couldn't read %s\n", argv[1]);
+		return 1;
+	}
+	if (length >= 4 && find_start_code(bytes, length, 0) == 0 && bytes[3] == PACK_HEADER) {
+		size_t video_length;
+		uint8_t *video = demux_video(bytes, length, &video_length);
+		free(bytes);
+		bytes = video;
+		length = video_length;
+	}
+
+	writer_t w = {malloc(1024), 0, 1024, 0};
+	int pictures = 0;
+	int dropped = 0;
+	int broken = 0;
+	int temporal_reference = 0;
+
+	size_t pos = find_start_code(bytes, length, 0);
+	while (pos < length) {
+		int code = bytes[pos + 3];
+		size_t next = find_start_code(bytes, length, pos + 4);
+
+		if (code == START_SEQUENCE || code == START_GOP) {
+			write_start_code(&w, code);
+			for (size_t i = pos + 4; i < next; i++) {
+				write_bits(&w, bytes[i], 8);
+			}
+			if (code == START_GOP) {
+				temporal_reference = 0;
+			}
+			pos = next;
+			continue;
+		}
+		if (code != START_PICTURE) {
+			pos = next; // user data, extensions and stray slices
+			continue;
+		}
+
+		reader_t r = {bytes, length, (pos + 4) << 3};
+		read_bits(&r, 10); // temporal_reference
+		int picture_type = read_bits(&r, 3);
+		int keep = picture_type == PICTURE_TYPE_INTRA || picture_type == PICTURE_TYPE_D;
+		if (keep) {
+			write_start_code(&w, START_PICTURE);
+			write_bits(&w, temporal_reference++, 10);
+			write_bits(&w, PICTURE_TYPE_D, 3);
+			write_bits(&w, 0xffff, 16); // vbv_delay: variable bit rate
+			write_bits(&w, 0, 1); // extra_bit_picture
+			pictures++;
+		}
+		else {
+			dropped++;
+		}
+
+		pos = next;
+		while (pos < length) {
+			code = bytes[pos + 3];
+			if (code < START_SLICE_FIRST || code > START_SLICE_LAST) {
+				break;
+			}
+			next = find_start_code(bytes, length, pos + 4);
+			if (keep) {
+				reader_t slice = {bytes, next, (pos + 4) << 3};
+				if (!convert_slice(&w, &slice, code, picture_type)) {
+					broken++;
+				}
+			}
+			pos = next;
+		}
+	}
+	write_start_code(&w, START_SEQUENCE_END);
+	free(bytes);
+
+	char *out_name = argc > 2 ? argv[2] : NULL;
+	if (!out_name) {
+		out_name = malloc(strlen(argv[1]) + 5);
+		sprintf(out_name, "%s.m1v", argv[1]);
+	}
+
+	FILE *fh = fopen(out_name, "wb");
+	if (!fh) {
+		printf("Couldn't write %s\n", out_name);
+		return 1;
+	}
+	fwrite(w.bytes, 1, w.length, fh);
+	fclose(fh);
+
+	if (broken) {
+		printf("Skipped the rest of %d broken slices\n", broken);
+	}
+	printf("Wrote %d D-pictures to %s, dropped %d pictures\n", pictures, out_name, dropped);
+	free(w.bytes);
+	return 0;
+}
@@ -0,0 +1,191 @@
+// pl_mpeg_index - generate a seek index sidecar file for pl_mpeg
+//
+// Usage: pl_mpeg_index input.mpg [output.idx]
+//
+// This runs on the host (make tools) and writes the intra frame packets and
+// the PTS range of the first video stream in the format read by
+// plm_demux_load_index(). Load it on the Dreamcast with plm_load_index() to
+// make seeking a single jump and to know the duration without searching the
+// end of the file. The output defaults to the input filename with ".idx"
+// appended.
+//
+// The scan follows plm_demux_decode(): the payloads of video, audio and
+// private packets are skipped, everything else is searched for start codes.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_VERSION 2
+#define NO_PTS UINT64_MAX
+
+#define PACKET_PRIVATE 0xBD
+#define PACKET_AUDIO_1 0xC0
+#define PACKET_AUDIO_4 0xC2
+#define PACKET_VIDEO_1 0xE0
+
+typedef struct {
+	uint32_t offset;
+	uint64_t pts;
+} index_entry_t;
+
+static uint8_t *read_file(const char *filename, size_t *length) {
+	FILE *fh = fopen(filename, "rb");
+	if (!fh) {
+		return NULL;
+	}
+	fseek(fh, 0, SEEK_END);
+	*length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+
+	uint8_t *bytes = malloc(*length + 1);
+	if (fread(bytes, 1, *length, fh) != *length) {
+		free(bytes);
+		bytes = NULL;
+	}
+	fclose(fh);
+	return bytes;
+}
+
+static void write_u32(FILE *fh, uint32_t value) {
+	uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+	fwrite(bytes, 1, 4, fh);
+}
+
+static void write_u64(FILE *fh, uint64_t value) {
+	write_u32(fh, value);
+	write_u32(fh, value >> 32);
+}
+
+static int is_intra(const uint8_t *data, size_t length) {
+	for (size_t i = 0; i + 6 < length; i++) {
+		if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01 && data[i + 3] == 0x00) {
+			return (data[i + 5] & 0x38) == 8;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s input.mpg [output.idx]\n", argv[0]);
+		return 1;
+	}
+
+	size_t length;
+	uint8_t *bytes = read_file(argv[1], &length);
+	if (!bytes) {
+		printf("Couldn't read %s\n", argv[1]);
+		return 1;
+	}
+	if (length > 0xffffffff) {
+		printf("%s is too large to be indexed\n", argv[1]);
+		return 1;
+	}
+
+	size_t capacity = 1024;
+	size_t count = 0;
+	index_entry_t *entries = malloc(capacity * sizeof(index_entry_t));
+	uint64_t first_pts = NO_PTS;
+	uint64_t last_pts = NO_PTS;
+
+	size_t pos = 0;
+	while (pos + 4 <= length) {
+		if (bytes[pos] != 0x00 || bytes[pos + 1] != 0x00 || bytes[pos + 2] != 0x01) {
+			pos++;
+			continue;
+		}
+
+		int code = bytes[pos + 3];
+		pos += 4;
+		if (
+			code != PACKET_VIDEO_1 &&
+			code != PACKET_PRIVATE &&
+			(code < PACKET_AUDIO_1 || code > PACKET_AUDIO_4)
+		) {
+			continue;
+		}
+		if (pos + 2 > length) {
+			break;
+		}
+
+		// The demuxer records packets by the offset just behind the start code
+		size_t packet_start = pos;
+		size_t packet_end = pos + 2 + ((bytes[pos] << 8) | bytes[pos + 1]);
+		if (packet_end > length) {
+			break;
+		}
+
+		size_t p = pos + 2;
+		pos = packet_end;
+		if (code != PACKET_VIDEO_1) {
+			continue;
+		}
+
+		while (p < packet_end && bytes[p] == 0xff) {
+			p++; // stuffing
+		}
+		if (p < packet_end && (bytes[p] >> 6) == 0x01) {
+			p += 2; // P-STD
+		}
+		if (p + 5 > packet_end) {
+			continue;
+		}
+
+		int pts_dts_marker = (bytes[p] >> 4) & 0x03;
+		if (pts_dts_marker != 0x02 && pts_dts_marker != 0x03) {
+			continue;
+		}
+		uint64_t pts =
+			((uint64_t)((bytes[p] >> 1) & 0x07) << 30) |
+			((uint64_t)bytes[p + 1] << 22) |
+			((uint64_t)(bytes[p + 2] >> 1) << 15) |
+			((uint64_t)bytes[p + 3] << 7) |
+			(bytes[p + 4] >> 1);
+		p += (pts_dts_marker == 0x03) ? 10 : 5;
+
+		if (first_pts == NO_PTS) {
+			first_pts = pts;
+		}
+		last_pts = pts;
+
+		if (p < packet_end && is_intra(bytes + p, packet_end - p)) {
+			if (count == capacity) {
+				capacity *= 2;
+				entries = realloc(entries, capacity * sizeof(index_entry_t));
+			}
+			entries[count].offset = packet_start;
+			entries[count].pts = pts;
+			count++;
+		}
+	}
+	free(bytes);
+
+	char *out_name = argc > 2 ? argv[2] : NULL;
+	if (!out_name) {
+		out_name = malloc(strlen(argv[1]) + 5);
+		sprintf(out_name, "%s.idx", argv[1]);
+	}
+
+	FILE *fh = fopen(out_name, "wb");
+	if (!fh) {
+		printf("Couldn't write %s\n", out_name);
+		return 1;
+	}
+	fwrite("PLMI", 1, 4, fh);
+	write_u32(fh, INDEX_VERSION);
+	write_u32(fh, length);
+	write_u32(fh, count);
+	write_u64(fh, first_pts);
+	write_u64(fh, last_pts);
+	for (size_t i = 0; i < count; i++) {
+		write_u32(fh, entries[i].offset);
+		write_u64(fh, entries[i].pts);
+	}
+	fclose(fh);
+
+	printf("Wrote %zu intra frames to %s\n", count, out_name);
+	free(entries);
+	return 0;
+}
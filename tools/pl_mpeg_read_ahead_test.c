@@ -0,0 +1,161 @@
+// pl_mpeg_read_ahead_test - decode a file through the read-ahead queue
+//
+// Usage: pl_mpeg_read_ahead_test input.mpg [read_delay_us]
+//
+// This runs on the host (make check) against tools/host/kos.h, whose fs_read()
+// sleeps for PLM_HOST_READ_DELAY_US microseconds per call to stand in for a
+// slow drive; read_delay_us sets it. The video of the file is decoded three
+// times: straight from the file, through a blocking read-ahead buffer and
+// through a non-blocking one that is polled once per frame interval while it
+// returns NULL. All frames, and the frames after a seek to the middle of the
+// file, have to be identical. The longest plm_decode_video() call of each run
+// is printed. Exits with 1 on a mismatch.
+
+#define PL_MPEG_IMPLEMENTATION
+#include "../pl_mpeg.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define READ_AHEAD_SIZE (256 * 1024)
+#define SEEK_FRAMES 8
+
+enum {
+	MODE_FILE,
+	MODE_BLOCKING,
+	MODE_NON_BLOCKING
+};
+
+static const char *MODE_NAMES[] = {"file", "blocking", "non-blocking"};
+
+typedef struct {
+	int frames;
+	int seek_frames;
+	int polls;
+	uint64_t hash;
+	uint64_t seek_hash;
+	double worst;
+} run_t;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t hash_frame(uint64_t hash, plm_frame_t *frame) {
+	size_t length = ((frame->width + 15) >> 4) * ((frame->height + 15) >> 4) * 384;
+	const uint8_t *bytes = (const uint8_t *)frame->display;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Decode the next frame; a non-blocking buffer is polled until it has one or
+// the file has ended.
+
+static plm_frame_t *decode_frame(plm_t *plm, run_t *run) {
+	double interval = 1.0 / plm_get_framerate(plm);
+	while (TRUE) {
+		double start = now();
+		plm_frame_t *frame = plm_decode_video(plm);
+		double elapsed = now() - start;
+		if (elapsed > run->worst) {
+			run->worst = elapsed;
+		}
+		if (frame || plm_has_ended(plm)) {
+			return frame;
+		}
+		run->polls++;
+		usleep(interval * 1000000);
+	}
+}
+
+static int decode_file(const char *filename, int mode, run_t *run) {
+	int fh = fs_open(filename, 0);
+	if (fh == -1) {
+		return FALSE;
+	}
+
+	plm_buffer_t *buffer = mode == MODE_FILE
+		? plm_buffer_create_with_file(fh, TRUE)
+		: plm_buffer_create_with_file_read_ahead(fh, TRUE, READ_AHEAD_SIZE);
+	if (mode == MODE_NON_BLOCKING) {
+		plm_buffer_set_read_ahead_blocking(buffer, FALSE);
+	}
+	plm_t *plm = plm_create_with_buffer(buffer, TRUE);
+
+	// A non-blocking buffer may not have the headers yet either
+	while (!plm_has_headers(plm)) {
+		if (mode != MODE_NON_BLOCKING || plm_buffer_has_ended(buffer)) {
+			plm_destroy(plm);
+			return FALSE;
+		}
+		usleep(1000);
+	}
+	plm_set_audio_enabled(plm, FALSE);
+
+	memset(run, 0, sizeof(run_t));
+	run->hash = 1469598103934665603ULL;
+	plm_frame_t *frame;
+	while ((frame = decode_frame(plm, run))) {
+		run->hash = hash_frame(run->hash, frame);
+		run->frames++;
+	}
+
+	// A non-blocking buffer can't seek before the data has arrived
+	run->seek_hash = 1469598103934665603ULL;
+	if (mode != MODE_NON_BLOCKING && plm_seek(plm, plm_get_duration(plm) / 2, TRUE)) {
+		for (int i = 0; i < SEEK_FRAMES && (frame = decode_frame(plm, run)); i++) {
+			run->seek_hash = hash_frame(run->seek_hash, frame);
+			run->seek_frames++;
+		}
+	}
+
+	plm_destroy(plm);
+	return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: pl_mpeg_read_ahead_test input.mpg [read_delay_us]\n");
+		return 1;
+	}
+	if (argc > 2) {
+		setenv("PLM_HOST_READ_DELAY_US", argv[2], TRUE);
+	}
+
+	run_t runs[3];
+	for (int mode = MODE_FILE; mode <= MODE_NON_BLOCKING; mode++) {
+		if (!decode_file(argv[1], mode, &runs[mode])) {
+			printf("Couldn't decode %s\n", argv[1]);
+			return 1;
+		}
+		printf(
+			"%s: %d frames, %d polls, worst decode %.1f ms, hash %016llx\n",
+			MODE_NAMES[mode], runs[mode].frames, runs[mode].polls,
+			runs[mode].worst * 1000, (unsigned long long)runs[mode].hash
+		);
+	}
+
+	int ok = TRUE;
+	for (int mode = MODE_BLOCKING; mode <= MODE_NON_BLOCKING; mode++) {
+		if (
+			runs[mode].frames != runs[MODE_FILE].frames ||
+			runs[mode].hash != runs[MODE_FILE].hash
+		) {
+			printf("%s: frames differ from reading the file\n", MODE_NAMES[mode]);
+			ok = FALSE;
+		}
+	}
+	if (
+		runs[MODE_FILE].seek_frames != SEEK_FRAMES ||
+		runs[MODE_BLOCKING].seek_frames != SEEK_FRAMES ||
+		runs[MODE_BLOCKING].seek_hash != runs[MODE_FILE].seek_hash
+	) {
+		printf("blocking: frames after seeking differ from reading the file\n");
+		ok = FALSE;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// pl_mpeg_threads_test - decode a file with several decoders at once
+//
+// Usage: pl_mpeg_threads_test input.mpg [threads]
+//
+// This runs on the host (make check) against tools/host/kos.h. The file is
+// decoded by threads (default 4) decoders that are created and run on threads
+// of their own at the same time, before any other decoder exists, and then
+// once more on the main thread. All of them have to produce the same video
+// frames and audio samples. Build it with -fsanitize=thread to check that
+// separate instances share no mutable state, including the lookup tables that
+// the first decoder builds. Exits with 1 on a mismatch.
+
+#define PL_MPEG_IMPLEMENTATION
+#include "../pl_mpeg.h"
+
+#include <stdio.h>
+
+#define MAX_THREADS 16
+
+typedef struct {
+	const char *filename;
+	int frames;
+	int samples;
+	uint64_t video_hash;
+	uint64_t audio_hash;
+} run_t;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void *decode_file(void *user) {
+	run_t *run = (run_t *)user;
+	run->video_hash = 1469598103934665603ULL;
+	run->audio_hash = 1469598103934665603ULL;
+
+	plm_t *plm = plm_create_with_filename(run->filename);
+	if (!plm) {
+		return NULL;
+	}
+
+	plm_frame_t *frame;
+	while ((frame = plm_decode_video(plm))) {
+		size_t length = ((frame->width + 15) >> 4) * ((frame->height + 15) >> 4) * 384;
+		run->video_hash = hash_bytes(run->video_hash, frame->display, length);
+		run->frames++;
+
+		// Keep the audio up with the video, so both decoders run in turn
+		plm_samples_t *samples;
+		while ((samples = plm_decode_audio(plm))) {
+			run->audio_hash = hash_bytes(run->audio_hash, samples->pcm, sizeof(samples->pcm));
+			run->samples++;
+			if (samples->time >= frame->time) {
+				break;
+			}
+		}
+	}
+
+	plm_destroy(plm);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("Usage: pl_mpeg_threads_test input.mpg [threads]\n");
+		return 1;
+	}
+	int count = argc > 2 ? atoi(argv[2]) : 4;
+	if (count < 1 || count > MAX_THREADS) {
+		printf("threads must be 1..%d\n", MAX_THREADS);
+		return 1;
+	}
+
+	run_t runs[MAX_THREADS] = {{0}};
+	kthread_t *threads[MAX_THREADS];
+	for (int i = 0; i < count; i++) {
+		runs[i].filename = argv[1];
+		threads[i] = thd_create(0, decode_file, &runs[i]);
+		if (!threads[i]) {
+			printf("Couldn't create thread %d\n", i);
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		thd_join(threads[i], NULL);
+	}
+
+	run_t reference = {0};
+	reference.filename = argv[1];
+	decode_file(&reference);
+	if (!reference.frames) {
+		printf("Couldn't decode %s\n", argv[1]);
+		return 1;
+	}
+	printf(
+		"reference: %d frames, %d samples, video %016llx, audio %016llx\n",
+		reference.frames, reference.samples,
+		(unsigned long long)reference.video_hash, (unsigned long long)reference.audio_hash
+	);
+
+	int ok = TRUE;
+	for (int i = 0; i < count; i++) {
+		if (
+			runs[i].frames != reference.frames ||
+			runs[i].samples != reference.samples ||
+			runs[i].video_hash != reference.video_hash ||
+			runs[i].audio_hash != reference.audio_hash
+		) {
+			printf(
+				"thread %d: %d frames, %d samples differ from the reference\n",
+				i, runs[i].frames, runs[i].samples
+			);
+			ok = FALSE;
+		}
+	}
+	if (ok) {
+		printf("%d concurrent decoders: ok\n", count);
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// pl_mpeg_vlc_test - check the VLC lookup tables of pl_mpeg.h
+//
+// Usage: pl_mpeg_vlc_test
+//
+// This runs on the host (make check). Every lookup table generated by
+// plm_video_init_vlc_luts() is fed every bit pattern long enough to hold its
+// longest code through plm_buffer_lookup_vlc(), and the value and length it
+// returns are compared with walking the VLC tree bit by bit with
+// plm_vlc_walk(). The dct_coeff tables additionally fold the sign bit,
+// end_of_block and escape; these are read as plm_video_decode_block_of()
+// does in its bitwise path. Exits with 1 on the first mismatch.
+
+#define PL_MPEG_IMPLEMENTATION
+#include "../pl_mpeg.h"
+
+#include <stdio.h>
+
+// No code is longer than 16 bits, plus the sign bit of a dct_coeff
+#define PATTERN_BITS 18
+
+typedef struct {
+	int16_t value;
+	int length;
+	int extra;
+} expected_t;
+
+static void expect_tree(const plm_vlc_t *table, int dct_coeff, int first, uint32_t code, expected_t *e) {
+	int16_t value = 0;
+	e->length = plm_vlc_walk(table, code, 32, &value);
+	e->value = value;
+	e->extra = 0;
+	if (!dct_coeff) {
+		return;
+	}
+
+	uint16_t coeff = (uint16_t)value;
+	if (coeff == 0xffff) {
+		e->value = 0;
+		e->extra = PLM_VIDEO_DCT_COEFF_ESCAPE;
+		return;
+	}
+	if (coeff == 0x0001 && !first) {
+		int bit = (code >> (31 - e->length)) & 1;
+		e->length++;
+		if (!bit) {
+			e->value = 0;
+			e->extra = PLM_VIDEO_DCT_COEFF_END_OF_BLOCK;
+			return;
+		}
+	}
+	int level = coeff & 0xff;
+	if ((code >> (31 - e->length)) & 1) {
+		level = -level;
+	}
+	e->length++;
+	e->value = level;
+	e->extra = coeff >> 8;
+}
+
+static int check_lut(
+	const char *name, plm_buffer_t *buffer,
+	const plm_vlc_lut_t *lut, int root_bits,
+	const plm_vlc_t *table, int dct_coeff, int first
+) {
+	for (uint32_t i = 0; i < (1 << PATTERN_BITS); i++) {
+		uint32_t code = i << (32 - PATTERN_BITS);
+		buffer->bytes[0] = code >> 24;
+		buffer->bytes[1] = code >> 16;
+		buffer->bytes[2] = code >> 8;
+		buffer->bytes[3] = code;
+		buffer->bit_index = 0;
+		plm_buffer_invalidate_cache(buffer);
+
+		expected_t e;
+		expect_tree(table, dct_coeff, first, code, &e);
+		const plm_vlc_lut_t *entry = plm_buffer_lookup_vlc(buffer, lut, root_bits);
+		int extra = dct_coeff ? entry->extra : 0;
+		if (
+			entry->value != e.value || entry->length != e.length ||
+			(int)buffer->bit_index != e.length || extra != e.extra
+		) {
+			printf(
+				"%s: code %08x: lut value %d length %d extra %d, "
+				"tree value %d length %d extra %d\n",
+				name, code, entry->value, entry->length, extra,
+				e.value, e.length, e.extra
+			);
+			return FALSE;
+		}
+	}
+	printf("%s: ok\n", name);
+	return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+	plm_video_init_vlc_luts();
+
+	uint8_t bytes[8] = {0};
+	plm_buffer_t *buffer = plm_buffer_create_with_memory(bytes, sizeof(bytes), FALSE);
+	plm_video_vlc_luts_t *luts = &plm_video_vlc_luts;
+	char name[64];
+	int ok = TRUE;
+
+	ok = ok && check_lut(
+		"macroblock_address_increment", buffer, luts->macroblock_address_increment,
+		PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT_BITS,
+		PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT, FALSE, FALSE
+	);
+	for (int i = 0; i < 4; i++) {
+		sprintf(name, "macroblock_type[%d]", i + 1);
+		ok = ok && check_lut(
+			name, buffer, luts->macroblock_type[i],
+			PLM_VIDEO_MACROBLOCK_TYPE_LUT_BITS,
+			PLM_VIDEO_MACROBLOCK_TYPE[i + 1], FALSE, FALSE
+		);
+	}
+	ok = ok && check_lut(
+		"code_block_pattern", buffer, luts->code_block_pattern,
+		PLM_VIDEO_CODE_BLOCK_PATTERN_LUT_BITS,
+		PLM_VIDEO_CODE_BLOCK_PATTERN, FALSE, FALSE
+	);
+	ok = ok && check_lut(
+		"motion_code", buffer, luts->motion_code,
+		PLM_VIDEO_MOTION_LUT_BITS,
+		PLM_VIDEO_MOTION, FALSE, FALSE
+	);
+	for (int i = 0; i < 2; i++) {
+		sprintf(name, "dct_size[%d]", i);
+		ok = ok && check_lut(
+			name, buffer, luts->dct_size[i],
+			PLM_VIDEO_DCT_SIZE_LUT_BITS,
+			PLM_VIDEO_DCT_SIZE[i], FALSE, FALSE
+		);
+	}
+	ok = ok && check_lut(
+		"dct_coeff first", buffer, luts->dct_coeff[0],
+		PLM_VIDEO_DCT_COEFF_LUT_BITS,
+		(const plm_vlc_t *)PLM_VIDEO_DCT_COEFF, TRUE, TRUE
+	);
+	ok = ok && check_lut(
+		"dct_coeff next", buffer, luts->dct_coeff[1],
+		PLM_VIDEO_DCT_COEFF_LUT_BITS,
+		(const plm_vlc_t *)PLM_VIDEO_DCT_COEFF, TRUE, FALSE
+	);
+
+	plm_buffer_destroy(buffer);
+	return ok ? 0 : 1;
+}